@@ -0,0 +1,82 @@
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <oak_util/atomic.h>
+#include <oak_util/memory.h>
+
+using namespace oak;
+
+namespace {
+
+	constexpr i32 MAX_THREAD_COUNT = 8;
+	constexpr i64 OPS_PER_THREAD = 1000000;
+	constexpr i64 BATCH_SIZE = 64;
+
+	// Stands in for the single heap lock every size class used to share
+	i32 _singleLock = 0;
+
+	// Each thread allocates and frees batches of one size class no other thread uses
+	template<bool singleLock>
+	void worker(Allocator *allocator, usize size) {
+		void *blocks[BATCH_SIZE];
+		for (i64 op = 0; op < OPS_PER_THREAD; op += BATCH_SIZE) {
+			for (auto& block : blocks) {
+				if constexpr (singleLock)
+					atomic_lock(&_singleLock);
+				block = allocator->allocate(size, 16);
+				if constexpr (singleLock)
+					atomic_unlock(&_singleLock);
+			}
+			for (auto block : blocks) {
+				if constexpr (singleLock)
+					atomic_lock(&_singleLock);
+				allocator->deallocate(block, size);
+				if constexpr (singleLock)
+					atomic_unlock(&_singleLock);
+			}
+		}
+	}
+
+	template<bool singleLock>
+	f64 run(i32 threadCount) {
+		auto allocator = make_heap_allocator(usize{ 1 } << 30);
+		if (!allocator.arena)
+			return -1.0;
+		SCOPE_EXIT(memory_heap_destroy(allocator.arena));
+
+		std::vector<std::thread> threads;
+		auto start = std::chrono::steady_clock::now();
+		for (i32 i = 0; i < threadCount; ++i)
+			threads.emplace_back(worker<singleLock>, &allocator, usize{ 16 } << i);
+		for (auto& thread : threads)
+			thread.join();
+		auto end = std::chrono::steady_clock::now();
+
+		return std::chrono::duration<f64, std::milli>(end - start).count();
+	}
+
+}
+
+int main() {
+	auto maxThreadCount = static_cast<i32>(std::thread::hardware_concurrency());
+	if (maxThreadCount < 2)
+		maxThreadCount = 2;
+	if (maxThreadCount > MAX_THREAD_COUNT)
+		maxThreadCount = MAX_THREAD_COUNT;
+
+	for (i32 threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2) {
+		auto perPool = run<false>(threadCount);
+		auto single = run<true>(threadCount);
+		if (perPool < 0.0 || single < 0.0) {
+			std::fprintf(stderr, "failed to create the heap allocator\n");
+			return 1;
+		}
+		auto ops = static_cast<f64>(threadCount * OPS_PER_THREAD * 2);
+		std::printf("threads=%d per-pool %.1f ms (%.1f Mops/s), single lock %.1f ms (%.1f Mops/s)\n",
+				threadCount, perPool, ops / perPool / 1000.0, single, ops / single / 1000.0);
+	}
+
+	return 0;
+}
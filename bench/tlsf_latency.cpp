@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+#include <oak_util/memory.h>
+#include <oak_util/random.h>
+
+using namespace oak;
+
+namespace {
+
+	constexpr i64 SLOT_COUNT = 8192;
+	constexpr i64 WARMUP_OPS = 200000;
+	constexpr i64 MEASURED_OPS = 2000000;
+
+	struct Block {
+		void *ptr;
+		usize size;
+	};
+
+	struct Latencies {
+		std::vector<i64> alloc;
+		std::vector<i64> free;
+		i64 pageFaults = -1;
+	};
+
+	i64 now_ns() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	i64 page_faults() {
+#ifdef __linux__
+		rusage usage;
+		if (getrusage(RUSAGE_THREAD, &usage) == 0)
+			return usage.ru_minflt + usage.ru_majflt;
+#endif
+		return -1;
+	}
+
+	// Mostly small blocks with the odd large one, freed in random order so the free lists fragment
+	usize random_size(PCGenerator *rng) {
+		auto r = rng->advance_state();
+		if (r % 64 == 0)
+			return 4096 + r % (256 << 10);
+		return 16 + r % 512;
+	}
+
+	Latencies run(Allocator *allocator) {
+		PCGenerator rng{ default_rng_params };
+		rng.init(0x5eed);
+
+		Latencies latencies;
+		// Touch the sample storage up front so its page faults don't land in the measured window
+		latencies.alloc.assign(MEASURED_OPS, 0);
+		latencies.alloc.clear();
+		latencies.free.assign(MEASURED_OPS, 0);
+		latencies.free.clear();
+
+		std::vector<Block> slots(SLOT_COUNT, Block{ nullptr, 0 });
+		i64 startFaults = -1;
+		for (i64 op = 0; op < WARMUP_OPS + MEASURED_OPS; ++op) {
+			auto& slot = slots[rng.advance_state() % SLOT_COUNT];
+			auto measured = op >= WARMUP_OPS;
+			if (op == WARMUP_OPS)
+				startFaults = page_faults();
+			if (slot.ptr) {
+				auto start = now_ns();
+				allocator->deallocate(slot.ptr, slot.size);
+				auto end = now_ns();
+				if (measured)
+					latencies.free.push_back(end - start);
+				slot.ptr = nullptr;
+			} else {
+				auto size = random_size(&rng);
+				// The heap can't align a block past its size class
+				auto alignment = size >= 64 && rng.advance_state() % 8 == 0 ? usize{ 64 } : usize{ 16 };
+				auto start = now_ns();
+				slot.ptr = allocator->allocate(size, alignment);
+				auto end = now_ns();
+				if (measured)
+					latencies.alloc.push_back(end - start);
+				slot.size = size;
+				// Touch the block so the first write to fresh pages isn't charged to the next operation
+				if (slot.ptr)
+					static_cast<u8*>(slot.ptr)[0] = 1;
+			}
+		}
+
+		if (startFaults >= 0)
+			latencies.pageFaults = page_faults() - startFaults;
+
+		for (auto& slot : slots) {
+			if (slot.ptr)
+				allocator->deallocate(slot.ptr, slot.size);
+		}
+
+		return latencies;
+	}
+
+	void report(char const *name, char const *op, std::vector<i64>& samples) {
+		std::sort(samples.begin(), samples.end());
+		auto count = static_cast<i64>(samples.size());
+		auto percentile = [&](f64 p) { return samples[std::min(count - 1, static_cast<i64>(p * count))]; };
+		std::printf("%-6s %-5s n=%-8ld p50=%-6ld p99=%-6ld p99.99=%-8ld max=%ld ns\n",
+				name, op, count, percentile(0.5), percentile(0.99), percentile(0.9999), samples.back());
+	}
+
+}
+
+int main() {
+	struct {
+		char const *name;
+		Allocator allocator;
+		void (*destroyFn)(MemoryArena*);
+	} allocators[] = {
+		{ "tlsf", make_tlsf_allocator(usize{ 256 } << 20), memory_tlsf_destroy },
+		{ "heap", make_heap_allocator(usize{ 256 } << 20), memory_heap_destroy },
+	};
+
+	for (auto& entry : allocators) {
+		if (!entry.allocator.arena) {
+			std::fprintf(stderr, "failed to create the %s allocator\n", entry.name);
+			return 1;
+		}
+		auto latencies = run(&entry.allocator);
+		report(entry.name, "alloc", latencies.alloc);
+		report(entry.name, "free", latencies.free);
+		std::printf("%-6s page faults while measuring: %ld\n", entry.name, latencies.pageFaults);
+		entry.destroyFn(entry.allocator.arena);
+	}
+
+	return 0;
+}
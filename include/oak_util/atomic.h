@@ -14,93 +14,244 @@
 
 #include "types.h"
 
+// Builds the lock functions with contention counters, the library and its users must agree on it
+#ifndef OAK_LOCK_PROFILING
+#define OAK_LOCK_PROFILING 0
+#endif
+
 namespace oak {
 
+	// Orders map onto the gcc builtins, msvc interlocked intrinsics are full barriers so only the compiler
+	// barriers follow the order there
+	enum class MemoryOrder {
+		RELAXED,
+		ACQUIRE,
+		RELEASE,
+		ACQ_REL,
+		SEQ_CST,
+	};
+
+	namespace detail {
+
+		constexpr int gcc_memory_order(MemoryOrder order) noexcept {
+#ifdef _MSC_VER
+			return static_cast<int>(order);
+#else
+			switch (order) {
+				case MemoryOrder::RELAXED: return __ATOMIC_RELAXED;
+				case MemoryOrder::ACQUIRE: return __ATOMIC_ACQUIRE;
+				case MemoryOrder::RELEASE: return __ATOMIC_RELEASE;
+				case MemoryOrder::ACQ_REL: return __ATOMIC_ACQ_REL;
+				case MemoryOrder::SEQ_CST: return __ATOMIC_SEQ_CST;
+			}
+			return __ATOMIC_SEQ_CST;
+#endif // _MSC_VER
+		}
+
+	}
+
+	template<MemoryOrder order = MemoryOrder::ACQUIRE>
 	inline i32 atomic_load(i32 *mem) noexcept {
+		static_assert(order != MemoryOrder::RELEASE && order != MemoryOrder::ACQ_REL, "invalid load order");
 #ifdef _MSC_VER
 		_ReadWriteBarrier();
 		return *reinterpret_cast<volatile long*>(mem);
 #else
-		return __atomic_load_n(mem, __ATOMIC_ACQUIRE);
+		return __atomic_load_n(mem, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
+	template<MemoryOrder order = MemoryOrder::ACQUIRE>
 	inline i64 atomic_load(i64 *mem) noexcept {
+		static_assert(order != MemoryOrder::RELEASE && order != MemoryOrder::ACQ_REL, "invalid load order");
 #ifdef _MSC_VER
 		_ReadWriteBarrier();
 		return *reinterpret_cast<volatile __int64*>(mem);
 #else
-		return __atomic_load_n(mem, __ATOMIC_ACQUIRE);
+		return __atomic_load_n(mem, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
+	template<MemoryOrder order = MemoryOrder::ACQUIRE>
 	inline u32 atomic_load(u32 *mem) noexcept {
+		static_assert(order != MemoryOrder::RELEASE && order != MemoryOrder::ACQ_REL, "invalid load order");
 #ifdef _MSC_VER
 		_ReadWriteBarrier();
 		return *reinterpret_cast<volatile unsigned long*>(mem);
 #else
-		return __atomic_load_n(mem, __ATOMIC_ACQUIRE);
+		return __atomic_load_n(mem, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
+	template<MemoryOrder order = MemoryOrder::ACQUIRE>
 	inline u64 atomic_load(u64 *mem) noexcept {
+		static_assert(order != MemoryOrder::RELEASE && order != MemoryOrder::ACQ_REL, "invalid load order");
 #ifdef _MSC_VER
 		_ReadWriteBarrier();
 		return *reinterpret_cast<volatile unsigned __int64*>(mem);
 #else
-		return __atomic_load_n(mem, __ATOMIC_ACQUIRE);
+		return __atomic_load_n(mem, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
+	template<MemoryOrder order = MemoryOrder::ACQUIRE>
 	inline void* atomic_load(void **mem) noexcept {
+		static_assert(order != MemoryOrder::RELEASE && order != MemoryOrder::ACQ_REL, "invalid load order");
 #ifdef _MSC_VER
 		_ReadWriteBarrier();
 		return *reinterpret_cast<void * volatile *>(mem);
 #else
-		return __atomic_load_n(mem, __ATOMIC_ACQUIRE);
+		return __atomic_load_n(mem, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
-	inline i32 atomic_store(i32 *mem, i32 value) noexcept {
+	template<MemoryOrder order = MemoryOrder::RELEASE>
+	inline void atomic_set(i32 *mem, i32 value) noexcept {
+		static_assert(order != MemoryOrder::ACQUIRE && order != MemoryOrder::ACQ_REL, "invalid store order");
 #ifdef _MSC_VER
-		return _InterlockedExchange(reinterpret_cast<volatile long*>(mem), value);
+		if constexpr (order == MemoryOrder::SEQ_CST) {
+			_InterlockedExchange(reinterpret_cast<volatile long*>(mem), static_cast<long>(value));
+		} else {
+			_ReadWriteBarrier();
+			*reinterpret_cast<volatile long*>(mem) = value;
+		}
 #else
-		return __atomic_exchange_n(mem, value, __ATOMIC_ACQ_REL);
+		__atomic_store_n(mem, value, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
-	inline i64 atomic_store(i64 *mem, i64 value) noexcept {
+	template<MemoryOrder order = MemoryOrder::RELEASE>
+	inline void atomic_set(i64 *mem, i64 value) noexcept {
+		static_assert(order != MemoryOrder::ACQUIRE && order != MemoryOrder::ACQ_REL, "invalid store order");
 #ifdef _MSC_VER
-		return _InterlockedExchange64(reinterpret_cast<volatile __int64*>(mem), value);
+		if constexpr (order == MemoryOrder::SEQ_CST) {
+			_InterlockedExchange64(reinterpret_cast<volatile __int64*>(mem), static_cast<__int64>(value));
+		} else {
+			_ReadWriteBarrier();
+			*reinterpret_cast<volatile __int64*>(mem) = value;
+		}
 #else
-		return __atomic_exchange_n(mem, value, __ATOMIC_ACQ_REL);
+		__atomic_store_n(mem, value, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
-	inline u32 atomic_store(u32 *mem, u32 value) noexcept {
+	template<MemoryOrder order = MemoryOrder::RELEASE>
+	inline void atomic_set(u32 *mem, u32 value) noexcept {
+		static_assert(order != MemoryOrder::ACQUIRE && order != MemoryOrder::ACQ_REL, "invalid store order");
+#ifdef _MSC_VER
+		if constexpr (order == MemoryOrder::SEQ_CST) {
+			_InterlockedExchange(reinterpret_cast<volatile long*>(mem), static_cast<long>(value));
+		} else {
+			_ReadWriteBarrier();
+			*reinterpret_cast<volatile unsigned long*>(mem) = value;
+		}
+#else
+		__atomic_store_n(mem, value, detail::gcc_memory_order(order));
+#endif // _MSC_VER
+	}
+
+	template<MemoryOrder order = MemoryOrder::RELEASE>
+	inline void atomic_set(u64 *mem, u64 value) noexcept {
+		static_assert(order != MemoryOrder::ACQUIRE && order != MemoryOrder::ACQ_REL, "invalid store order");
+#ifdef _MSC_VER
+		if constexpr (order == MemoryOrder::SEQ_CST) {
+			_InterlockedExchange64(reinterpret_cast<volatile __int64*>(mem), static_cast<__int64>(value));
+		} else {
+			_ReadWriteBarrier();
+			*reinterpret_cast<volatile unsigned __int64*>(mem) = value;
+		}
+#else
+		__atomic_store_n(mem, value, detail::gcc_memory_order(order));
+#endif // _MSC_VER
+	}
+
+	template<MemoryOrder order = MemoryOrder::RELEASE>
+	inline void atomic_set(void **mem, void *value) noexcept {
+		static_assert(order != MemoryOrder::ACQUIRE && order != MemoryOrder::ACQ_REL, "invalid store order");
+#ifdef _MSC_VER
+		if constexpr (order == MemoryOrder::SEQ_CST) {
+			_InterlockedExchangePointer(reinterpret_cast<void * volatile *>(mem), value);
+		} else {
+			_ReadWriteBarrier();
+			*reinterpret_cast<void * volatile *>(mem) = value;
+		}
+#else
+		__atomic_store_n(mem, value, detail::gcc_memory_order(order));
+#endif // _MSC_VER
+	}
+
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline i32 atomic_exchange(i32 *mem, i32 value) noexcept {
 #ifdef _MSC_VER
 		return _InterlockedExchange(reinterpret_cast<volatile long*>(mem), value);
 #else
-		return __atomic_exchange_n(mem, value, __ATOMIC_ACQ_REL);
+		return __atomic_exchange_n(mem, value, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
-	inline u64 atomic_store(u64 *mem, u64 value) noexcept {
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline i64 atomic_exchange(i64 *mem, i64 value) noexcept {
 #ifdef _MSC_VER
 		return _InterlockedExchange64(reinterpret_cast<volatile __int64*>(mem), value);
 #else
-		return __atomic_exchange_n(mem, value, __ATOMIC_ACQ_REL);
+		return __atomic_exchange_n(mem, value, detail::gcc_memory_order(order));
+#endif // _MSC_VER
+	}
+
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline u32 atomic_exchange(u32 *mem, u32 value) noexcept {
+#ifdef _MSC_VER
+		return static_cast<u32>(_InterlockedExchange(reinterpret_cast<volatile long*>(mem), static_cast<long>(value)));
+#else
+		return __atomic_exchange_n(mem, value, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
-	inline void* atomic_store(void **mem, void* value) noexcept {
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline u64 atomic_exchange(u64 *mem, u64 value) noexcept {
+#ifdef _MSC_VER
+		return static_cast<u64>(_InterlockedExchange64(reinterpret_cast<volatile __int64*>(mem), static_cast<__int64>(value)));
+#else
+		return __atomic_exchange_n(mem, value, detail::gcc_memory_order(order));
+#endif // _MSC_VER
+	}
+
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline void* atomic_exchange(void **mem, void *value) noexcept {
 #ifdef _MSC_VER
 		return _InterlockedExchangePointer(reinterpret_cast<void * volatile *>(mem), value);
 #else
-		return __atomic_exchange_n(mem, value, __ATOMIC_ACQ_REL);
+		return __atomic_exchange_n(mem, value, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
+	// Kept for existing callers, this is an exchange and returns the previous value. Plain stores are atomic_set.
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline i32 atomic_store(i32 *mem, i32 value) noexcept {
+		return atomic_exchange<order>(mem, value);
+	}
+
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline i64 atomic_store(i64 *mem, i64 value) noexcept {
+		return atomic_exchange<order>(mem, value);
+	}
+
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline u32 atomic_store(u32 *mem, u32 value) noexcept {
+		return atomic_exchange<order>(mem, value);
+	}
+
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline u64 atomic_store(u64 *mem, u64 value) noexcept {
+		return atomic_exchange<order>(mem, value);
+	}
+
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline void* atomic_store(void **mem, void *value) noexcept {
+		return atomic_exchange<order>(mem, value);
+	}
+
+	template<MemoryOrder order = MemoryOrder::ACQ_REL, MemoryOrder failure = MemoryOrder::RELAXED>
 	inline bool atomic_compare_exchange(i32 *mem, i32 *expected, i32 value) noexcept {
 #ifdef _MSC_VER
 		auto prev = _InterlockedCompareExchange(reinterpret_cast<volatile long*>(mem), value, *expected);
@@ -115,11 +266,12 @@ namespace oak {
 				expected,
 				value,
 				false,
-				__ATOMIC_ACQ_REL,
-				__ATOMIC_RELAXED);
+				detail::gcc_memory_order(order),
+				detail::gcc_memory_order(failure));
 #endif // _MSC_VER
 	}
 
+	template<MemoryOrder order = MemoryOrder::ACQ_REL, MemoryOrder failure = MemoryOrder::RELAXED>
 	inline bool atomic_compare_exchange(i64 *mem, i64 *expected, i64 value) noexcept {
 #ifdef _MSC_VER
 		auto prev = _InterlockedCompareExchange64(reinterpret_cast<volatile __int64*>(mem), value, *expected);
@@ -134,14 +286,37 @@ namespace oak {
 				expected,
 				value,
 				false,
-				__ATOMIC_ACQ_REL,
-				__ATOMIC_RELAXED);
+				detail::gcc_memory_order(order),
+				detail::gcc_memory_order(failure));
 #endif // _MSC_VER
 	}
 
+	template<MemoryOrder order = MemoryOrder::ACQ_REL, MemoryOrder failure = MemoryOrder::RELAXED>
+	inline bool atomic_compare_exchange(u32 *mem, u32 *expected, u32 value) noexcept {
+#ifdef _MSC_VER
+		auto prev = static_cast<u32>(_InterlockedCompareExchange(
+				reinterpret_cast<volatile long*>(mem), static_cast<long>(value), static_cast<long>(*expected)));
+		if (prev == *expected)
+			return true;
+
+		*expected = prev;
+		return false;
+#else
+		return __atomic_compare_exchange_n(
+				mem,
+				expected,
+				value,
+				false,
+				detail::gcc_memory_order(order),
+				detail::gcc_memory_order(failure));
+#endif // _MSC_VER
+	}
+
+	template<MemoryOrder order = MemoryOrder::ACQ_REL, MemoryOrder failure = MemoryOrder::RELAXED>
 	inline bool atomic_compare_exchange(u64 *mem, u64 *expected, u64 value) noexcept {
 #ifdef _MSC_VER
-		auto prev = static_cast<u64>(_InterlockedCompareExchange64(reinterpret_cast<volatile __int64*>(mem), value, *expected));
+		auto prev = static_cast<u64>(_InterlockedCompareExchange64(
+				reinterpret_cast<volatile __int64*>(mem), static_cast<__int64>(value), static_cast<__int64>(*expected)));
 		if (prev == *expected)
 			return true;
 
@@ -153,11 +328,12 @@ namespace oak {
 				expected,
 				value,
 				false,
-				__ATOMIC_ACQ_REL,
-				__ATOMIC_RELAXED);
+				detail::gcc_memory_order(order),
+				detail::gcc_memory_order(failure));
 #endif // _MSC_VER
 	}
 
+	template<MemoryOrder order = MemoryOrder::ACQ_REL, MemoryOrder failure = MemoryOrder::RELAXED>
 	inline bool atomic_compare_exchange(void **mem, void **expected, void *value) noexcept {
 #ifdef _MSC_VER
 		auto prev = _InterlockedCompareExchangePointer(reinterpret_cast<void * volatile *>(mem), value, *expected);
@@ -172,110 +348,298 @@ namespace oak {
 				expected,
 				value,
 				false,
-				__ATOMIC_ACQ_REL,
-				__ATOMIC_RELAXED);
+				detail::gcc_memory_order(order),
+				detail::gcc_memory_order(failure));
 #endif // _MSC_VER
 	}
 
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
 	inline i32 atomic_fetch_add(i32 *mem, i32 value) noexcept {
 #ifdef _MSC_VER
 		return _InterlockedExchangeAdd(reinterpret_cast<volatile long*>(mem), value);
 #else
-		return __atomic_fetch_add(mem, value, __ATOMIC_ACQ_REL);
+		return __atomic_fetch_add(mem, value, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
-	inline u32 atomic_fetch_add(u32 *mem, u32 value) noexcept {
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline i64 atomic_fetch_add(i64 *mem, i64 value) noexcept {
 #ifdef _MSC_VER
-		return _InterlockedExchangeAdd(reinterpret_cast<volatile long*>(mem), value);
+		return _InterlockedExchangeAdd64(reinterpret_cast<volatile __int64*>(mem), value);
 #else
-		return __atomic_fetch_add(mem, value, __ATOMIC_ACQ_REL);
+		return __atomic_fetch_add(mem, value, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
-	inline i64 atomic_fetch_add(i64 *mem, i64 value) noexcept {
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
+	inline u32 atomic_fetch_add(u32 *mem, u32 value) noexcept {
 #ifdef _MSC_VER
-		return _InterlockedExchangeAdd64(reinterpret_cast<volatile __int64*>(mem), value);
+		return static_cast<u32>(_InterlockedExchangeAdd(reinterpret_cast<volatile long*>(mem), static_cast<long>(value)));
 #else
-		return __atomic_fetch_add(mem, value, __ATOMIC_ACQ_REL);
+		return __atomic_fetch_add(mem, value, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
 	inline u64 atomic_fetch_add(u64 *mem, u64 value) noexcept {
 #ifdef _MSC_VER
-		return _InterlockedExchangeAdd64(reinterpret_cast<volatile __int64*>(mem), value);
+		return static_cast<u64>(_InterlockedExchangeAdd64(reinterpret_cast<volatile __int64*>(mem), static_cast<__int64>(value)));
 #else
-		return __atomic_fetch_add(mem, value, __ATOMIC_ACQ_REL);
+		return __atomic_fetch_add(mem, value, detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
+	template<MemoryOrder order = MemoryOrder::ACQ_REL>
 	inline void* atomic_fetch_add(void **mem, void *value) noexcept {
 #ifdef _MSC_VER
-		return _InterlockedExchangePointer(reinterpret_cast<void * volatile *>(mem), value);
+#ifdef _WIN64
+		return reinterpret_cast<void*>(_InterlockedExchangeAdd64(
+				reinterpret_cast<volatile __int64*>(mem), reinterpret_cast<__int64>(value)));
+#else
+		return reinterpret_cast<void*>(_InterlockedExchangeAdd(
+				reinterpret_cast<volatile long*>(mem), reinterpret_cast<long>(value)));
+#endif // _WIN64
+#else
+		// The builtin adds bytes to pointers, the same as adding the integer value
+		return __atomic_fetch_add(mem, reinterpret_cast<intptr_t>(value), detail::gcc_memory_order(order));
+#endif // _MSC_VER
+	}
+
+	template<MemoryOrder order = MemoryOrder::SEQ_CST>
+	inline void atomic_thread_fence() noexcept {
+#if defined(_MSC_VER) && defined(_M_ARM64)
+		__dmb(_ARM64_BARRIER_ISH);
+#elif defined(_MSC_VER)
+		if constexpr (order == MemoryOrder::SEQ_CST)
+			_mm_mfence();
+		else
+			_ReadWriteBarrier();
 #else
-		return __atomic_fetch_add(mem, reinterpret_cast<long>(value), __ATOMIC_ACQ_REL);
+		__atomic_thread_fence(detail::gcc_memory_order(order));
 #endif // _MSC_VER
 	}
 
+	inline void cpu_relax() noexcept {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		_mm_pause();
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+		__yield();
+#elif defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+		__asm__ __volatile__("yield");
+#endif
+	}
+
+	// Blocks while *mem is still expected, may return spuriously. Waits on linux also work across processes
+	// for memory shared between them.
+	OAK_UTIL_API void atomic_wait(i32 *mem, i32 expected) noexcept;
+	OAK_UTIL_API void atomic_wake_one(i32 *mem) noexcept;
+	OAK_UTIL_API void atomic_wake_all(i32 *mem) noexcept;
+	OAK_UTIL_API void atomic_lock_contended(i32 *lock) noexcept;
+	OAK_UTIL_API void atomic_rw_lock_read_contended(i32 *rwLock) noexcept;
+	OAK_UTIL_API void atomic_rw_lock_write_contended(i32 *rwLock) noexcept;
+
+	struct LockProfileStats {
+		void const *lock = nullptr;
+		char const *name = nullptr;
+		u64 acquisitionCount = 0;
+		u64 contendedCount = 0;
+		u64 spinCount = 0;
+		u64 totalWaitNs = 0;
+		u64 maxWaitNs = 0;
+	};
+
+	// Without OAK_LOCK_PROFILING these do nothing and the report is always empty
+	OAK_UTIL_API void atomic_lock_profile_name(void const *lock, char const *name) noexcept;
+	// Fills stats with up to count locks in order of their total wait time and returns how many were written
+	OAK_UTIL_API isize atomic_lock_profile_report(LockProfileStats *stats, isize count) noexcept;
+	OAK_UTIL_API void atomic_lock_profile_reset() noexcept;
+#if OAK_LOCK_PROFILING
+	OAK_UTIL_API void atomic_lock_profile_acquire(void const *lock) noexcept;
+#endif
+
+	// Locks are 0 when unlocked, 1 when locked and 2 when locked with threads possibly waiting on it
 	inline void atomic_lock(i32 *lock) noexcept {
 		i32 locked = 0;
-
-		// TODO: Maybe use _mm_pause here to decrease cpu usage
-		while (!atomic_compare_exchange(lock, &locked, 1))
-			locked = 0;
+		if (!atomic_compare_exchange<MemoryOrder::ACQUIRE>(lock, &locked, 1))
+			atomic_lock_contended(lock);
+#if OAK_LOCK_PROFILING
+		atomic_lock_profile_acquire(lock);
+#endif
 	}
 
 	inline bool atomic_try_lock(i32 *lock) noexcept {
 		i32 locked = 0;
-		return atomic_compare_exchange(lock, &locked, 1);
+#if OAK_LOCK_PROFILING
+		if (!atomic_compare_exchange<MemoryOrder::ACQUIRE>(lock, &locked, 1))
+			return false;
+		atomic_lock_profile_acquire(lock);
+		return true;
+#else
+		return atomic_compare_exchange<MemoryOrder::ACQUIRE>(lock, &locked, 1);
+#endif
 	}
 
 	inline void atomic_unlock(i32 *lock) noexcept {
-		[[maybe_unused]] auto oldValue = atomic_store(lock, 0);
-		assert(oldValue == 1 && "unlocked non locked lock");
+		auto oldValue = atomic_exchange<MemoryOrder::RELEASE>(lock, 0);
+		assert(oldValue != 0 && "unlocked non locked lock");
+		if (oldValue == 2)
+			atomic_wake_one(lock);
 	}
 
-	inline void atomic_rw_lock_read(i32 *rwLock) noexcept {
-		i32 locked = atomic_load(rwLock);
-		if (locked > 0)
-			locked = 0;
+	// Rw locks hold the reader count in the low bits. Once a writer is waiting new readers queue behind it so
+	// a steady stream of readers can't starve writers.
+	constexpr i32 RW_LOCK_WRITER = 1 << 30;
+	constexpr i32 RW_LOCK_WRITER_WAIT = 1 << 29;
+	constexpr i32 RW_LOCK_READER_WAIT = 1 << 28;
+	constexpr i32 RW_LOCK_READER_MASK = RW_LOCK_READER_WAIT - 1;
 
-		while (!atomic_compare_exchange(rwLock, &locked, locked - 1))
-			if (locked > 0)
-				locked = 0;
+	inline void atomic_rw_lock_read(i32 *rwLock) noexcept {
+		i32 locked = atomic_load<MemoryOrder::RELAXED>(rwLock);
+		if ((locked & (RW_LOCK_WRITER|RW_LOCK_WRITER_WAIT))
+				|| !atomic_compare_exchange<MemoryOrder::ACQUIRE>(rwLock, &locked, locked + 1))
+			atomic_rw_lock_read_contended(rwLock);
+#if OAK_LOCK_PROFILING
+		atomic_lock_profile_acquire(rwLock);
+#endif
 	}
 
 	inline bool atomic_rw_try_lock_read(i32 *rwLock) noexcept {
-		i32 locked = atomic_load(rwLock);
-		if (locked > 0)
-			return false;
-
-		while (!atomic_compare_exchange(rwLock, &locked, locked - 1))
-			if (locked > 0)
+		i32 locked = atomic_load<MemoryOrder::RELAXED>(rwLock);
+		do {
+			if (locked & (RW_LOCK_WRITER|RW_LOCK_WRITER_WAIT))
 				return false;
+		} while (!atomic_compare_exchange<MemoryOrder::ACQUIRE>(rwLock, &locked, locked + 1));
 
+#if OAK_LOCK_PROFILING
+		atomic_lock_profile_acquire(rwLock);
+#endif
 		return true;
 	}
 
 	inline void atomic_rw_unlock_read(i32 *rwLock) noexcept {
-		[[maybe_unused]] auto oldValue = atomic_fetch_add(rwLock, 1);
-		assert(oldValue < 0 && "unlocked non read locked rw lock");
+		auto oldValue = atomic_fetch_add<MemoryOrder::RELEASE>(rwLock, -1);
+		assert((oldValue & RW_LOCK_READER_MASK) != 0 && "unlocked non read locked rw lock");
+		// The last reader out lets a waiting writer in
+		if ((oldValue & RW_LOCK_READER_MASK) == 1 && (oldValue & RW_LOCK_WRITER_WAIT))
+			atomic_wake_all(rwLock);
 	}
 
 	inline void atomic_rw_lock_write(i32 *rwLock) noexcept {
-		atomic_lock(rwLock);
+		i32 locked = 0;
+		if (!atomic_compare_exchange<MemoryOrder::ACQUIRE>(rwLock, &locked, RW_LOCK_WRITER))
+			atomic_rw_lock_write_contended(rwLock);
+#if OAK_LOCK_PROFILING
+		atomic_lock_profile_acquire(rwLock);
+#endif
 	}
 
 	inline i32 atomic_rw_try_lock_write(i32 *rwLock) noexcept {
 		i32 locked = 0;
-		if (atomic_compare_exchange(rwLock, &locked, 1))
+		if (atomic_compare_exchange<MemoryOrder::ACQUIRE>(rwLock, &locked, RW_LOCK_WRITER)) {
+#if OAK_LOCK_PROFILING
+			atomic_lock_profile_acquire(rwLock);
+#endif
 			return 0;
+		}
 
 		return locked;
 	}
 
 	inline void atomic_rw_unlock_write(i32 *rwLock) noexcept {
-		atomic_unlock(rwLock);
+		auto oldValue = atomic_exchange<MemoryOrder::RELEASE>(rwLock, 0);
+		assert((oldValue & RW_LOCK_WRITER) && "unlocked non write locked rw lock");
+		if (oldValue & (RW_LOCK_WRITER_WAIT|RW_LOCK_READER_WAIT))
+			atomic_wake_all(rwLock);
+	}
+
+	// Read mostly rw lock, readers only touch a counter on their own cache line so they don't contend with
+	// each other. Writers pay for scanning every counter.
+	struct ScalableRWLock {
+		static constexpr i32 SLOT_COUNT = 16;
+
+		struct alignas(64) ReaderSlot {
+			i32 readers = 0;
+		};
+
+		// First so the lock and its writer word share an address in lock profiles
+		alignas(64) i32 writer = 0;
+		ReaderSlot slots[SLOT_COUNT];
+	};
+
+	OAK_UTIL_API void atomic_rw_lock_read(ScalableRWLock *rwLock) noexcept;
+	OAK_UTIL_API bool atomic_rw_try_lock_read(ScalableRWLock *rwLock) noexcept;
+	OAK_UTIL_API void atomic_rw_unlock_read(ScalableRWLock *rwLock) noexcept;
+	OAK_UTIL_API void atomic_rw_lock_write(ScalableRWLock *rwLock) noexcept;
+	OAK_UTIL_API bool atomic_rw_try_lock_write(ScalableRWLock *rwLock) noexcept;
+	OAK_UTIL_API void atomic_rw_unlock_write(ScalableRWLock *rwLock) noexcept;
+
+	// Sequence lock for small read mostly values, readers never write to shared memory and retry when a write
+	// overlapped their copy. The value is kept as words so every access to it is atomic.
+	template<typename T>
+	struct SeqLock {
+		static_assert(std::is_trivially_copyable_v<T>, "seq lock values are copied while being written");
+
+		static constexpr usize WORD_COUNT = (sizeof(T) + sizeof(u64) - 1) / sizeof(u64);
+
+		// Odd while a write is in progress
+		alignas(64) u64 sequence = 0;
+		u64 words[WORD_COUNT] = {};
+
+		SeqLock() = default;
+
+		explicit SeqLock(T const& value) noexcept {
+			memcpy(words, &value, sizeof(T));
+		}
+	};
+
+	template<typename T>
+	T atomic_seqlock_read(SeqLock<T> *seqLock) noexcept {
+		u64 words[SeqLock<T>::WORD_COUNT];
+		for (;;) {
+			auto sequence = atomic_load(&seqLock->sequence);
+			if (sequence & 1) {
+				cpu_relax();
+				continue;
+			}
+
+			for (usize i = 0; i < SeqLock<T>::WORD_COUNT; ++i)
+				words[i] = atomic_load<MemoryOrder::RELAXED>(seqLock->words + i);
+
+			// Keeps the word loads from moving past the second sequence check
+			atomic_thread_fence<MemoryOrder::ACQUIRE>();
+			if (atomic_load<MemoryOrder::RELAXED>(&seqLock->sequence) == sequence)
+				break;
+		}
+
+		T value;
+		memcpy(&value, words, sizeof(T));
+		return value;
 	}
+
+	// Concurrent writers are serialized by the sequence itself
+	template<typename T>
+	void atomic_seqlock_write(SeqLock<T> *seqLock, T const& value) noexcept {
+		u64 words[SeqLock<T>::WORD_COUNT] = {};
+		memcpy(words, &value, sizeof(T));
+
+		auto sequence = atomic_load<MemoryOrder::RELAXED>(&seqLock->sequence);
+		for (;;) {
+			if (!(sequence & 1)
+					&& atomic_compare_exchange<MemoryOrder::ACQUIRE>(&seqLock->sequence, &sequence, sequence + 1))
+				break;
+			cpu_relax();
+			sequence = atomic_load<MemoryOrder::RELAXED>(&seqLock->sequence);
+		}
+		// Readers that see any of the new words also see the odd sequence
+		atomic_thread_fence<MemoryOrder::RELEASE>();
+
+		for (usize i = 0; i < SeqLock<T>::WORD_COUNT; ++i)
+			atomic_set<MemoryOrder::RELAXED>(seqLock->words + i, words[i]);
+
+		atomic_set<MemoryOrder::RELEASE>(&seqLock->sequence, sequence + 2);
+	}
+
 }
 
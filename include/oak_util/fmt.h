@@ -234,15 +234,29 @@ namespace oak {
 		i64 capacity = 0;
 	};
 
-	template<typename Buffer, typename... TArgs>
-	void buffer_fmt(Buffer&& buffer, String fmtStr, TArgs&&... args) {
-		constexpr auto hasResize = HasResizeMethod<std::decay_t<Buffer>>::value;
-		if constexpr (sizeof...(args) > 0) {
+	namespace detail {
+
+		template<typename Buffer>
+		Allocator* buffer_allocator(Buffer const&) {
+			return nullptr;
+		}
+
+		inline Allocator* buffer_allocator(StringBuffer const& buffer) {
+			return buffer.allocator;
+		}
+
+	}
+
+	namespace detail {
+
+		template<typename Buffer, typename... TArgs>
+		void buffer_fmt_args(Allocator *allocator, Buffer&& buffer, String fmtStr, TArgs&&... args) {
+			constexpr auto hasResize = HasResizeMethod<std::decay_t<Buffer>>::value;
 			FmtSpec fmtSpecs[sizeof...(args)] = {};
 			String argStrings[sizeof...(args)] = {};
-			detail::fmt_get_spec(fmtStr, fmtSpecs, sizeof...(args));
-			detail::fmt_get_strings(
-					temporaryAllocator,
+			fmt_get_spec(fmtStr, fmtSpecs, sizeof...(args));
+			fmt_get_strings(
+					allocator,
 					argStrings,
 					fmtSpecs,
 					std::make_index_sequence<sizeof...(args)>{},
@@ -259,7 +273,27 @@ namespace oak {
 				}
 				buffer.resize(totalSize);
 			}
-			detail::fmt_impl(std::forward<Buffer>(buffer), fmtStr, argStrings, fmtSpecs, sizeof...(args));
+			fmt_impl(std::forward<Buffer>(buffer), fmtStr, argStrings, fmtSpecs, sizeof...(args));
+		}
+
+	}
+
+	template<typename Buffer, typename... TArgs>
+	void buffer_fmt(Buffer&& buffer, String fmtStr, TArgs&&... args) {
+		constexpr auto hasResize = HasResizeMethod<std::decay_t<Buffer>>::value;
+		if constexpr (sizeof...(args) > 0) {
+			// The argument strings only live until the buffer is written, the buffer's own allocator must not
+			// be the scratch arena or resizing it would be undone when the scratch scope ends
+			auto callerAllocator = detail::buffer_allocator(buffer);
+			auto scratch = get_scratch(callerAllocator);
+			if (scratch.allocator) {
+				detail::buffer_fmt_args(
+						scratch.allocator, std::forward<Buffer>(buffer), fmtStr, std::forward<TArgs>(args)...);
+			} else {
+				// The scratch arena couldn't be reserved, format on the stack and spill to the caller's allocator
+				TMP_ALLOC_WITH_FALLBACK(1024, callerAllocator ? callerAllocator : globalAllocator);
+				detail::buffer_fmt_args(&tmpAlloc, std::forward<Buffer>(buffer), fmtStr, std::forward<TArgs>(args)...);
+			}
 		} else {
 			if constexpr(hasResize)
 				buffer.resize(fmtStr.count);
@@ -22,6 +22,11 @@ namespace oak {
 		enum FlagBits : u32 {
 			CHAINED_BIT = 0x1,
 			SUB_ALLOCATED_BIT = 0x2,
+			MIRRORED_BIT = 0x4,
+			SHARED_BIT = 0x8,
+			CHECKPOINTED_BIT = 0x10,
+			FILE_BACKED_BIT = 0x20,
+			THREAD_OWNED_BIT = 0x40,
 		};
 
 		usize capacity = 0;
@@ -41,11 +46,152 @@ namespace oak {
 		alignas(64) i32 _lock = 0;
 		MemoryArena *_nextArena = nullptr;
 		u64 _threadId = 0;
+		// Epoch of the owning multi threaded arena this thread arena was last cleared in
+		u64 _epoch = 0;
+	};
+
+	struct MemoryArenaMarker {
+		usize usedMemory = 0;
+		i64 allocationCount = 0;
+		usize requestedMemory = 0;
+	};
+
+	struct MemorySharedHeader {
+		static constexpr u64 MAGIC = 0x316d68735f6b616f; // "oak_shm1"
+
+		// Written last by the creating process, attaching processes refuse the arena until it is set
+		u64 magic = 0;
+		usize mappedSize = 0;
+	};
+
+	struct MemoryCheckpointHeader {
+		i32 fd = -1;
+		// While a checkpoint is active the arena is mapped copy on write over its memfd
+		bool active = false;
+		// The header page is never remapped, a restore rolls the header back to these
+		MemoryArenaMarker marker;
+		usize alignSize = 0;
+	};
+
+	struct MemoryFileHeader {
+		static constexpr u64 MAGIC = 0x316c69665f6b616f; // "oak_fil1"
+
+		u64 magic = 0;
+		// Address the arena was last mapped at, reopening tries to map it there again
+		void *baseAddress = nullptr;
+		i32 fd = -1;
+	};
+
+	// Offsets from the arena base stay valid in every process that maps a shared arena
+	template<typename T>
+	struct ArenaSlice {
+		u64 offset = 0;
+		i64 count = 0;
 	};
 
 	struct MemoryPoolHeader {
 		usize objectSize = 0;
 		void *freeList = nullptr;
+		// Objects freed by threads other than the owner of a thread owned pool
+		void *remoteFreeList = nullptr;
+	};
+
+	struct MemoryStackHeader {
+		Allocator *fallback = nullptr;
+		void *spillList = nullptr;
+	};
+
+	struct MemoryRingHeader {
+		// Monotonic positions, the ring offset of a position is position % ringSize
+		u64 head = 0;
+		u64 tail = 0;
+		u64 lastAllocation = 0;
+		usize ringSize = 0;
+		void *ring = nullptr;
+	};
+
+	struct MemoryBuddyHeader {
+		usize minBlockSize = 0;
+		i32 maxOrder = 0;
+		// Per node of the implicit block tree the largest free order in its subtree plus one, 0 when full
+		u8 *orderTree = nullptr;
+		// One bit per minimum sized block that has been committed
+		u64 *commitBits = nullptr;
+		// Committed header and bookkeeping pages, the block region starts after some reserved slack
+		usize metaSize = 0;
+		void *blocks = nullptr;
+	};
+
+	struct MemoryTlsfHeader {
+		static constexpr i32 FL_COUNT = 32;
+		static constexpr i32 SL_COUNT = 32;
+
+		u32 flBitmap = 0;
+		u32 slBitmaps[FL_COUNT] = {};
+		void *freeLists[FL_COUNT][SL_COUNT] = {};
+		void *blocks = nullptr;
+	};
+
+	// Handles are 20 bits of slot index under 12 bits of generation, 0 is never a valid handle
+	using MemoryHandle = u32;
+
+	struct MemoryHandleSlot {
+		void *ptr = nullptr;
+		u32 generation = 0;
+		// Next free slot plus one while the slot is free
+		u32 nextFree = 0;
+	};
+
+	struct MemoryHandleHeader {
+		static constexpr u32 INDEX_BITS = 20;
+		static constexpr u32 INDEX_MASK = (u32{ 1 } << INDEX_BITS) - 1;
+		static constexpr u32 GENERATION_MASK = (u32{ 1 } << (32 - INDEX_BITS)) - 1;
+
+		MemoryHandleSlot *slots = nullptr;
+		u32 maxSlotCount = 0;
+		u32 slotCount = 0;
+		u32 freeSlot = 0;
+
+		void *blocks = nullptr;
+		usize blocksCapacity = 0;
+		usize blocksCommitSize = 0;
+		// Blocks are laid out back to back below top, deadMemory counts the freed ones still in between
+		usize top = 0;
+		usize deadMemory = 0;
+		// An incremental compaction pass has moved every live block below compactCursor down to compactDest
+		usize compactCursor = 0;
+		usize compactDest = 0;
+	};
+
+	struct MemorySysHeader {
+		// Freed spans are kept in buckets by log2 of their page count until reused or purged
+		usize retainedMemory = 0;
+		usize maxRetainedMemory = 0;
+		void *spanBuckets[16] = {};
+	};
+
+	struct MemoryHeapSegment {
+		void *base = nullptr;
+		usize capacity = 0;
+		usize usedMemory = 0;
+		usize commitSize = 0;
+		// Pages at or past this offset have never been handed out and are still zero filled
+		usize freshOffset = 0;
+	};
+
+	// Each size class has its own lock and stats on its own cache line, only page acquisition takes the
+	// arena lock
+	struct alignas(64) MemoryHeapPool {
+		void *freeList = nullptr;
+		// Slots of the most recent page are handed out lazily from the cursor
+		void *pageCursor = nullptr;
+		void *pageEnd = nullptr;
+		bool pageFresh = false;
+
+		i64 allocationCount = 0;
+		usize requestedMemory = 0;
+
+		i32 _lock = 0;
 	};
 
 	struct MemoryHeapHeader {
@@ -54,7 +200,20 @@ namespace oak {
 		usize heapSmallPageSize = 0;
 		usize heapLargePageSize = 0;
 
-		void *poolFreeLists[16] = {};
+		MemoryHeapPool pools[16];
+		// Pages at or past this offset have never been handed out and are still zero filled
+		usize freshOffset = 0;
+		// Objects freed by threads other than the owner of a thread owned heap, collected by the owner once
+		// the matching free list runs empty
+		void *remoteFreeLists[16] = {};
+
+		// Reservations added once the arena can't grow in place, pages are carved from the active one onwards
+		// where 0 is the arena itself and i is segments[i - 1]
+		usize maxSize = 0;
+		usize reservedSize = 0;
+		i32 segmentCount = 0;
+		i32 activeSegment = 0;
+		MemoryHeapSegment segments[16] = {};
 	};
 
 	struct MTMemoryArenaHeader {
@@ -68,25 +227,74 @@ namespace oak {
 		MemoryArena *last = nullptr;
 
 		alignas(64) i32 _lock = 0;
+		// Read by every thread on allocation and written only when advancing, so it gets its own cache line
+		alignas(64) u64 epoch = 0;
+	};
+
+	// Tags are small integer categories for per subsystem accounting, tag 0 is untracked
+	constexpr u32 MEMORY_TAG_COUNT = 64;
+
+	struct MemoryTagStats {
+		u32 tag = 0;
+		char const *name = nullptr;
+		i64 currentBytes = 0;
+		i64 peakBytes = 0;
 	};
 
+	// Tracked byte counts are buffered per thread and flushed to the shared counters once a tag's pending
+	// delta reaches 16KB, so current is exact to within 16KB per thread
+	OAK_UTIL_API void memory_tag_track(u32 tag, i64 bytes);
+	OAK_UTIL_API void memory_tag_flush();
+	// The name isn't copied and must outlive its use in reports
+	OAK_UTIL_API void memory_tag_set_name(u32 tag, char const *name);
+	// Fills stats with up to count tags in order of their current bytes and returns how many were written.
+	// Peaks are only raised when a thread flushes its batch, so they can be low by up to 16KB per thread.
+	OAK_UTIL_API isize memory_tag_top(MemoryTagStats *stats, isize count);
+
 	struct Allocator {
 		MemoryArena *arena = nullptr;
 		void* (*allocFn)(MemoryArena *self, u64 size, u64 alignment) = nullptr;
 		void (*freeFn)(MemoryArena *self, void *ptr, u64 size) = nullptr;
 		void* (*reallocFn)(MemoryArena *self, void *ptr, u64 size, u64 newSize, u64 alignment) = nullptr;
 		void (*clearFn)(MemoryArena *self) = nullptr;
+		// Optional, allocators that know when their memory is still zero filled can skip clearing it
+		void* (*allocZeroedFn)(MemoryArena *self, u64 size, u64 alignment) = nullptr;
+		// Allocations through a tagged allocator are counted against the tag, clear doesn't know what was
+		// live so memory released by it isn't
+		u32 tag = 0;
 
 		inline void* allocate(u64 size, u64 alignment) {
-			return (*allocFn)(arena, size, alignment);
+			auto result = (*allocFn)(arena, size, alignment);
+			if (tag && result)
+				memory_tag_track(tag, static_cast<i64>(size));
+			return result;
+		}
+
+		inline void* allocate_zeroed(u64 size, u64 alignment) {
+			void *result;
+			if (allocZeroedFn) {
+				result = (*allocZeroedFn)(arena, size, alignment);
+			} else {
+				result = (*allocFn)(arena, size, alignment);
+				if (result)
+					memset(result, 0, size);
+			}
+			if (tag && result)
+				memory_tag_track(tag, static_cast<i64>(size));
+			return result;
 		}
 
 		inline void deallocate(void *ptr, u64 size) {
 			(*freeFn)(arena, ptr, size);
+			if (tag && ptr)
+				memory_tag_track(tag, -static_cast<i64>(size));
 		}
 
 		inline void* realloc(void *ptr, u64 size, u64 newSize, u64 alignment) {
-			return (*reallocFn)(arena, ptr, size, newSize, alignment);
+			auto result = (*reallocFn)(arena, ptr, size, newSize, alignment);
+			if (tag && result)
+				memory_tag_track(tag, static_cast<i64>(newSize) - static_cast<i64>(ptr ? size : 0));
+			return result;
 		}
 
 		inline void clear() {
@@ -100,6 +308,22 @@ namespace oak {
 	OAK_UTIL_API i32 commit_region(void *addr, usize size);
 	OAK_UTIL_API i32 decommit_region(void *addr, usize size);
 
+	// Committed bytes of every allocator are counted by commit_region / decommit_region, shared, file backed,
+	// checkpointed and mirrored mappings are counted when they are mapped and unmapped. Once the limit is
+	// crossed or the memory pressure source reports more than avg10Threshold percent of stalled time,
+	// memory_budget_poll releases the arena cache and runs the registered trim callbacks. Callbacks are
+	// only ever run from memory_budget_poll, outside of any allocator lock. No allocator registers itself,
+	// callers register a callback that runs memory_arena_trim / memory_heap_trim on the arenas they own.
+	using MemoryTrimFn = void (*)(void *userData);
+	OAK_UTIL_API usize memory_budget_committed();
+	OAK_UTIL_API void memory_budget_set_limit(usize maxCommittedBytes);
+	OAK_UTIL_API i32 memory_budget_register_trim(MemoryTrimFn fn, void *userData);
+	OAK_UTIL_API void memory_budget_unregister_trim(MemoryTrimFn fn, void *userData);
+	// Defaults to the cgroup PSI file /proc/pressure/memory, any file in the same format can stand in for it
+	OAK_UTIL_API void memory_pressure_set_source(char const *path, f32 avg10Threshold);
+	OAK_UTIL_API bool memory_pressure_poll();
+	OAK_UTIL_API bool memory_budget_poll();
+
 	OAK_UTIL_API i32 memory_arena_init(MemoryArena **arena, usize size);
 	OAK_UTIL_API i32 memory_arena_init(MemoryArena **arena, void *addr, usize size);
 	OAK_UTIL_API void memory_arena_align_size(MemoryArena *arena, usize alignSize);
@@ -109,6 +333,35 @@ namespace oak {
 	OAK_UTIL_API void* memory_arena_realloc(
 			MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment);
 	OAK_UTIL_API void memory_arena_clear(MemoryArena *arena);
+	// Decommits the pages past the arena's used memory
+	OAK_UTIL_API void memory_arena_trim(MemoryArena *arena);
+	// Destroyed arena reservations are kept, committed pages included, for reuse by arenas of the same size
+	OAK_UTIL_API void memory_arena_cache_set_limit(usize maxCachedBytes);
+	OAK_UTIL_API void memory_arena_cache_purge();
+	OAK_UTIL_API MemoryArenaMarker memory_arena_get_marker(MemoryArena *arena);
+	OAK_UTIL_API void memory_arena_reset_to_marker(MemoryArena *arena, MemoryArenaMarker marker);
+	// True when the arena is thread owned by the calling thread
+	OAK_UTIL_API bool memory_arena_is_owner(MemoryArena *arena);
+	// Shared arenas are fully committed and backed by a memfd, or by a posix shared memory object when a
+	// name is given, that other processes map with memory_arena_attach_shared. The creator owns fd and the
+	// name and must close and shm_unlink them once every process has attached.
+	OAK_UTIL_API i32 memory_arena_init_shared(MemoryArena **arena, i32 *fd, usize size, char const *name = nullptr);
+	OAK_UTIL_API i32 memory_arena_attach_shared(MemoryArena **arena, i32 fd);
+	OAK_UTIL_API i32 memory_arena_attach_shared(MemoryArena **arena, char const *name);
+	// Checkpointed arenas are fully committed and backed by a memfd. Taking a checkpoint maps the arena
+	// privately so a restore only throws away the pages written since. The header keeps its own page, a
+	// restore rolls it back to the state saved by the checkpoint. Allocations start after the header page.
+	OAK_UTIL_API i32 memory_arena_init_checkpointed(MemoryArena **arena, usize size);
+	OAK_UTIL_API i32 memory_arena_checkpoint(MemoryArena *arena);
+	OAK_UTIL_API i32 memory_arena_restore(MemoryArena *arena);
+	OAK_UTIL_API i32 memory_arena_drop_checkpoint(MemoryArena *arena);
+	// File backed arenas map their committed pages MAP_SHARED over the file, the arena header included, so
+	// reopening the file brings back everything allocated in it. A new file reserves size bytes at baseAddress
+	// if possible, an existing one at the address it was last mapped at. When that address is taken the arena
+	// is relocated and only offset based data (see ArenaSlice) is still valid.
+	OAK_UTIL_API i32 memory_arena_open_file(
+			MemoryArena **arena, char const *path, usize size, void *baseAddress = nullptr, bool *relocated = nullptr);
+	OAK_UTIL_API i32 memory_arena_sync(MemoryArena *arena);
 
 	OAK_UTIL_API i32 memory_pool_init(MemoryArena **arena, usize size, usize objectSize);
 	OAK_UTIL_API void memory_pool_destroy(MemoryArena *arena);
@@ -119,12 +372,74 @@ namespace oak {
 	OAK_UTIL_API void memory_pool_clear(MemoryArena *arena);
 	OAK_UTIL_API usize memory_pool_get_object_size(MemoryArena *arena);
 
-	OAK_UTIL_API i32 memory_heap_init(MemoryArena **arena, usize size);
+	OAK_UTIL_API i32 memory_stack_init(MemoryArena **arena, void *addr, usize size, Allocator *fallback);
+	OAK_UTIL_API void memory_stack_destroy(MemoryArena *arena);
+	OAK_UTIL_API void* memory_stack_alloc(MemoryArena *arena, usize size, usize alignment);
+	OAK_UTIL_API void memory_stack_free(MemoryArena *arena, void *addr, usize size);
+	OAK_UTIL_API void* memory_stack_realloc(
+			MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment);
+	OAK_UTIL_API void memory_stack_clear(MemoryArena *arena);
+
+	// A mirrored ring maps its memory twice back to back so allocations never have to skip the wrap point.
+	// Mirroring is only supported on linux, elsewhere a mirrored init returns 1 and no arena is created.
+	OAK_UTIL_API i32 memory_ring_init(MemoryArena **arena, usize size, bool mirrored = false);
+	OAK_UTIL_API void memory_ring_destroy(MemoryArena *arena);
+	OAK_UTIL_API void* memory_ring_alloc(MemoryArena *arena, usize size, usize alignment);
+	OAK_UTIL_API void memory_ring_free(MemoryArena *arena, void *addr, usize size);
+	OAK_UTIL_API void* memory_ring_realloc(
+			MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment);
+	OAK_UTIL_API void memory_ring_clear(MemoryArena *arena);
+	// Everything allocated before the fence was taken is released by memory_ring_release_until(fence)
+	OAK_UTIL_API u64 memory_ring_fence(MemoryArena *arena);
+	OAK_UTIL_API void memory_ring_release_until(MemoryArena *arena, u64 fence);
+
+	// Every block is aligned to its own size, allocations may ask for any alignment up to the block size
+	// their size rounds up to
+	OAK_UTIL_API i32 memory_buddy_init(MemoryArena **arena, usize size, usize minBlockSize = 64 << 10);
+	OAK_UTIL_API void memory_buddy_destroy(MemoryArena *arena);
+	OAK_UTIL_API void* memory_buddy_alloc(MemoryArena *arena, usize size, usize alignment);
+	OAK_UTIL_API void memory_buddy_free(MemoryArena *arena, void *addr, usize size);
+	OAK_UTIL_API void* memory_buddy_realloc(
+			MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment);
+	OAK_UTIL_API void memory_buddy_clear(MemoryArena *arena);
+
+	// Two level segregated fit allocator, the whole reservation is committed and faulted in up front so
+	// alloc and free never make a syscall or take a page fault and run in constant time. Memory for the
+	// whole size is resident from init on.
+	OAK_UTIL_API i32 memory_tlsf_init(MemoryArena **arena, usize size);
+	OAK_UTIL_API void memory_tlsf_destroy(MemoryArena *arena);
+	OAK_UTIL_API void* memory_tlsf_alloc(MemoryArena *arena, usize size, usize alignment);
+	OAK_UTIL_API void memory_tlsf_free(MemoryArena *arena, void *addr, usize size);
+	OAK_UTIL_API void* memory_tlsf_realloc(
+			MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment);
+	OAK_UTIL_API void memory_tlsf_clear(MemoryArena *arena);
+
+	// Blocks are addressed through generational handles so compaction can move them. Pointers returned by
+	// memory_handle_get stay valid until the next free or compaction step on the arena.
+	OAK_UTIL_API i32 memory_handle_init(MemoryArena **arena, usize size);
+	OAK_UTIL_API void memory_handle_destroy(MemoryArena *arena);
+	// Payloads are 16 byte aligned, returns 0 when out of memory or slots
+	OAK_UTIL_API MemoryHandle memory_handle_alloc(MemoryArena *arena, usize size);
+	OAK_UTIL_API void memory_handle_free(MemoryArena *arena, MemoryHandle handle);
+	OAK_UTIL_API void memory_handle_clear(MemoryArena *arena);
+	// Moves live blocks toward the start of the arena until budget is spent and returns true once a pass has
+	// finished and the pages past the last block have been released. Moving a block costs its size and
+	// visiting any block, dead ones included, costs 64 bytes more.
+	OAK_UTIL_API bool memory_handle_compact(MemoryArena *arena, usize budget);
+
+	// The heap starts out reserving size bytes and grows, in place when possible, until it has reserved maxSize
+	OAK_UTIL_API i32 memory_heap_init(MemoryArena **arena, usize size, usize maxSize = ~usize{ 0 });
+	OAK_UTIL_API void memory_heap_destroy(MemoryArena *arena);
 	OAK_UTIL_API void* memory_heap_alloc(MemoryArena *arena, usize size, usize alignment);
+	OAK_UTIL_API void* memory_heap_alloc_zeroed(MemoryArena *arena, usize size, usize alignment);
 	OAK_UTIL_API void memory_heap_free(MemoryArena *arena, void *addr, usize size);
 	OAK_UTIL_API void* memory_heap_realloc(
 			MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment);
 	OAK_UTIL_API void memory_heap_clear(MemoryArena *arena);
+	// Decommits the pages of every reservation that no size class has carved yet
+	OAK_UTIL_API void memory_heap_trim(MemoryArena *arena);
+	// Heap stats are kept per size class, the arena header's allocationCount and requestedMemory stay zero
+	OAK_UTIL_API void memory_heap_get_stats(MemoryArena *arena, i64 *allocationCount, usize *requestedMemory);
 
 	OAK_UTIL_API i32 mt_memory_arena_init(MemoryArena **arena, usize size);
 	OAK_UTIL_API void mt_memory_arena_destroy(MemoryArena *arena);
@@ -133,6 +448,10 @@ namespace oak {
 	OAK_UTIL_API void* mt_memory_arena_realloc(
 			MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment);
 	OAK_UTIL_API void mt_memory_arena_clear(MemoryArena *arena);
+	// Clears every thread's arena right away, no thread may be using memory from them
+	OAK_UTIL_API void mt_memory_arena_clear_all(MemoryArena *arena);
+	// Starts a new epoch, each thread clears its own arena on its next allocation
+	OAK_UTIL_API u64 mt_memory_arena_next_epoch(MemoryArena *arena);
 
 	OAK_UTIL_API i32 sys_alloc_init(MemoryArena **arena);
 	OAK_UTIL_API void sys_alloc_destroy(MemoryArena *arena);
@@ -141,11 +460,21 @@ namespace oak {
 	OAK_UTIL_API void* sys_realloc(
 			MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment);
 	OAK_UTIL_API void sys_clear(MemoryArena *arena);
+	OAK_UTIL_API void sys_alloc_set_retain_limit(MemoryArena *arena, usize maxRetainedMemory);
+	OAK_UTIL_API void sys_alloc_purge(MemoryArena *arena);
 
 	OAK_UTIL_API Allocator make_arena_allocator(usize size);
 	OAK_UTIL_API Allocator make_arena_allocator(void *addr, usize size);
+	OAK_UTIL_API Allocator make_stack_allocator(void *addr, usize size, Allocator *fallback);
+	OAK_UTIL_API Allocator make_ring_allocator(usize size, bool mirrored = false);
+	OAK_UTIL_API Allocator make_buddy_allocator(usize size, usize minBlockSize = 64 << 10);
+	OAK_UTIL_API Allocator make_tlsf_allocator(usize size);
 	OAK_UTIL_API Allocator make_pool_allocator(usize size, usize objectSize);
-	OAK_UTIL_API Allocator make_heap_allocator(usize size);
+	OAK_UTIL_API Allocator make_heap_allocator(usize size, usize maxSize = ~usize{ 0 });
+	// Thread owned allocators never lock, they must only allocate on the calling thread but may be freed
+	// into from any thread
+	OAK_UTIL_API Allocator make_thread_pool_allocator(usize size, usize objectSize);
+	OAK_UTIL_API Allocator make_thread_heap_allocator(usize size, usize maxSize = ~usize{ 0 });
 	OAK_UTIL_API Allocator make_mt_arena_allocator(usize size);
 	OAK_UTIL_API Allocator make_sys_allocator();
 
@@ -154,6 +483,10 @@ namespace oak {
 	OAK_UTIL_API void* global_allocator_realloc(void *ptr, usize size);
 	OAK_UTIL_API void global_allocator_free(void *ptr);
 
+	// Returns one of the calling thread's two scratch arenas, never one whose arena is in conflicts. Scratch
+	// arenas are owned by the thread and never lock. Returns nullptr if the arena can't be reserved.
+	OAK_UTIL_API Allocator* scratch_allocator(MemoryArena *const *conflicts, i64 conflictCount);
+
 	OAK_UTIL_API void* temporary_allocator_malloc(usize size);
 	OAK_UTIL_API void* temporary_allocator_realloc(void *ptr, usize size);
 	OAK_UTIL_API void temporary_allocator_free(void *ptr);
@@ -173,6 +506,11 @@ namespace oak {
 		return static_cast<T*>(allocator->allocate(sizeof(T) * count, alignof(T)));
 	}
 
+	template<typename T>
+	T* allocate_zeroed(Allocator *allocator, i64 count) {
+		return static_cast<T*>(allocator->allocate_zeroed(sizeof(T) * count, alignof(T)));
+	}
+
 	template<typename... types>
 	void* allocate_soa(Allocator *allocator, i64 count) {
 		return allocator->allocate(soa_offset<sizeof...(types), types...>(count), max_align<types...>());
@@ -226,12 +564,147 @@ namespace oak {
 		deallocate<T>(allocator, ptr, count);
 	}
 
+	inline u64 memory_arena_offset(MemoryArena *arena, void const *addr) noexcept {
+		return addr ? static_cast<u64>(ptr_diff(addr, arena)) : 0;
+	}
+
+	template<typename T>
+	T* memory_arena_ptr(MemoryArena *arena, u64 offset) noexcept {
+		return offset ? static_cast<T*>(add_ptr(arena, offset)) : nullptr;
+	}
+
+	template<typename T>
+	ArenaSlice<T> to_arena_slice(MemoryArena *arena, Slice<T> slice) noexcept {
+		return { memory_arena_offset(arena, slice.data), slice.count };
+	}
+
+	inline ArenaSlice<char const> to_arena_slice(MemoryArena *arena, String str) noexcept {
+		return { memory_arena_offset(arena, str.data), str.count };
+	}
+
+	template<typename T>
+	Slice<T> from_arena_slice(MemoryArena *arena, ArenaSlice<T> slice) noexcept {
+		return { memory_arena_ptr<T>(arena, slice.offset), slice.count };
+	}
+
+	// Returns nullptr for a freed, stale or out of range handle
+	inline void* memory_handle_get(MemoryArena *arena, MemoryHandle handle) noexcept {
+		auto handleHeader = static_cast<MemoryHandleHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
+		auto index = handle & MemoryHandleHeader::INDEX_MASK;
+		// Slots past slotCount may not be committed yet
+		if (index >= handleHeader->slotCount)
+			return nullptr;
+		auto& slot = handleHeader->slots[index];
+		return slot.generation == handle >> MemoryHandleHeader::INDEX_BITS ? slot.ptr : nullptr;
+	}
+
+#if defined(__SANITIZE_ADDRESS__)
+#	define OAK_ARENA_HANDLE_INLINE 0
+#elif defined(__has_feature)
+#	if __has_feature(address_sanitizer)
+#		define OAK_ARENA_HANDLE_INLINE 0
+#	endif
+#endif
+#ifndef OAK_ARENA_HANDLE_INLINE
+#	define OAK_ARENA_HANDLE_INLINE 1
+#endif
+
+	// Bumps the cursor of a plain arena inline without locking, only calls into the library when more pages
+	// have to be committed. The arena must not be used from other threads while handles to it are in use,
+	// a thread owned arena only by its owner. Allocation counts are kept the same as memory_arena_alloc and
+	// allocations are counted against tag like they are through a tagged Allocator.
+	// Under ASAN every allocation takes the out of line path so memory keeps getting poisoned.
+	struct ArenaHandle {
+		MemoryArena *arena = nullptr;
+		u32 tag = 0;
+
+		inline void* allocate(usize size, usize alignment) noexcept {
+			[[maybe_unused]] auto header = bit_cast<MemoryArenaHeader*>(arena);
+			assert((!(header->flags & MemoryArenaHeader::THREAD_OWNED_BIT) || memory_arena_is_owner(arena))
+					&& "thread owned arena used by another thread");
+			void *result = nullptr;
+#if OAK_ARENA_HANDLE_INLINE
+			assert(alignment <= header->pageSize);
+			auto offset = align(header->usedMemory, alignment);
+			auto end = offset + align(size, header->alignSize);
+			if (end <= header->commitSize) {
+				header->usedMemory = end;
+				header->allocationCount += 1;
+				header->requestedMemory += size;
+				result = add_ptr(header, offset);
+			}
+#endif
+			if (!result)
+				result = memory_arena_alloc(arena, size, alignment);
+			if (tag && result)
+				memory_tag_track(tag, static_cast<i64>(size));
+			return result;
+		}
+
+		inline void deallocate(void *ptr, usize size) noexcept {
+			[[maybe_unused]] auto header = bit_cast<MemoryArenaHeader*>(arena);
+			assert((!(header->flags & MemoryArenaHeader::THREAD_OWNED_BIT) || memory_arena_is_owner(arena))
+					&& "thread owned arena used by another thread");
+#if OAK_ARENA_HANDLE_INLINE
+			auto alignedSize = align(size, header->alignSize);
+			if (add_ptr(header, header->usedMemory - alignedSize) == ptr)
+				header->usedMemory -= alignedSize;
+			header->allocationCount -= 1;
+			header->requestedMemory -= size;
+#else
+			memory_arena_free(arena, ptr, size);
+#endif
+			if (tag && ptr)
+				memory_tag_track(tag, -static_cast<i64>(size));
+		}
+
+		template<typename T>
+		T* allocate(i64 count) noexcept {
+			return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+		}
+	};
+
 	OAK_UTIL_API inline Allocator* globalAllocator = nullptr;
 	OAK_UTIL_API inline Allocator* temporaryAllocator = nullptr;
 
-	#define TMP_ALLOC(size)\
-		alignas(64) u8 _tmpMemory[sizeof(MemoryArenaHeader) + size];\
-		Allocator tmpAlloc = make_arena_allocator(_tmpMemory, sizeof(_tmpMemory))
+	// Reservation size of each thread local scratch arena, read when a thread first requests scratch memory
+	OAK_UTIL_API inline usize scratchArenaSize = usize{ 64 } << 20;
+
+	struct ScratchArena {
+		Allocator *allocator = nullptr;
+		MemoryArenaMarker marker;
+
+		explicit ScratchArena(Allocator *allocator_) noexcept : allocator{ allocator_ } {
+			if (allocator)
+				marker = memory_arena_get_marker(allocator->arena);
+		}
+
+		ScratchArena(ScratchArena const&) = delete;
+		ScratchArena& operator=(ScratchArena const&) = delete;
+
+		~ScratchArena() noexcept {
+			if (allocator)
+				memory_arena_reset_to_marker(allocator->arena, marker);
+		}
+	};
+
+	// Pass the allocators that hold memory which must outlive the scratch scope as conflicts, i.e. the
+	// allocator a result is returned in when the caller itself might be using a scratch arena
+	template<typename... TArgs>
+	ScratchArena get_scratch(TArgs... conflicts) noexcept {
+		static_assert((std::is_same_v<TArgs, Allocator*> && ...), "Scratch conflicts must be Allocator pointers");
+		MemoryArena *arenas[] = { nullptr, (conflicts ? conflicts->arena : nullptr)... };
+		return ScratchArena{ scratch_allocator(arenas + 1, sizeof...(conflicts)) };
+	}
+
+	// Serves allocations from a stack buffer of the given size and spills the rest to the fallback allocator,
+	// spilled blocks are released when the enclosing scope ends
+	#define TMP_ALLOC_WITH_FALLBACK(size, fallback)\
+		alignas(64) u8 _tmpMemory[sizeof(MemoryArenaHeader) + sizeof(MemoryStackHeader) + size];\
+		Allocator tmpAlloc = make_stack_allocator(_tmpMemory, sizeof(_tmpMemory), fallback);\
+		SCOPE_EXIT(memory_stack_destroy(tmpAlloc.arena))
+
+	#define TMP_ALLOC(size) TMP_ALLOC_WITH_FALLBACK(size, globalAllocator)
 
 }
 
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <memory_resource>
+#include <new>
+
+#include "types.h"
+#include "memory.h"
+
+namespace oak {
+
+	namespace detail {
+
+		[[noreturn]] inline void throw_bad_alloc() {
+#if defined(__cpp_exceptions) || defined(_CPPUNWIND)
+			throw std::bad_alloc{};
+#else
+			abort();
+#endif
+		}
+
+	}
+
+	// Lets std::pmr containers allocate from an oak allocator, the allocator must outlive the resource
+	struct AllocatorResource : std::pmr::memory_resource {
+		Allocator *allocator = nullptr;
+
+		explicit AllocatorResource(Allocator *allocator_) noexcept : allocator{ allocator_ } {}
+
+	private:
+		void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+			// Zero sized requests still need a unique address
+			auto result = allocator->allocate(bytes ? bytes : 1, alignment);
+			if (!result)
+				detail::throw_bad_alloc();
+			return result;
+		}
+
+		void do_deallocate(void *ptr, std::size_t bytes, std::size_t) override {
+			allocator->deallocate(ptr, bytes ? bytes : 1);
+		}
+
+		bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override {
+			return this == &other;
+		}
+	};
+
+	// Standard allocator for containers that don't take a memory_resource, sizes are passed through to
+	// the oak allocator on deallocate
+	template<typename T>
+	struct StdAllocator {
+		using value_type = T;
+
+		Allocator *allocator = nullptr;
+
+		StdAllocator(Allocator *allocator_) noexcept : allocator{ allocator_ } {}
+
+		template<typename U>
+		StdAllocator(StdAllocator<U> const& other) noexcept : allocator{ other.allocator } {}
+
+		T* allocate(std::size_t count) {
+			auto result = static_cast<T*>(allocator->allocate(sizeof(T) * (count ? count : 1), alignof(T)));
+			if (!result)
+				detail::throw_bad_alloc();
+			return result;
+		}
+
+		void deallocate(T *ptr, std::size_t count) noexcept {
+			allocator->deallocate(ptr, sizeof(T) * (count ? count : 1));
+		}
+	};
+
+	template<typename T, typename U>
+	bool operator==(StdAllocator<T> const& lhs, StdAllocator<U> const& rhs) noexcept {
+		return lhs.allocator == rhs.allocator;
+	}
+
+	template<typename T, typename U>
+	bool operator!=(StdAllocator<T> const& lhs, StdAllocator<U> const& rhs) noexcept {
+		return lhs.allocator != rhs.allocator;
+	}
+
+}
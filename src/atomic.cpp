@@ -0,0 +1,395 @@
+#define OAK_UTIL_EXPORT_SYMBOLS
+#include <oak_util/atomic.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#define NOGDI
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <sched.h>
+#endif // _WIN32
+
+#if OAK_LOCK_PROFILING
+#include <time.h>
+#endif
+
+namespace oak {
+
+namespace {
+
+	// Spin rounds before sleeping, each round doubles the number of pauses
+	constexpr i32 SPIN_ROUNDS = 7;
+
+	void _thread_yield() {
+#ifdef _WIN32
+		SwitchToThread();
+#elif defined(__linux__)
+		syscall(SYS_sched_yield);
+#else
+		sched_yield();
+#endif // _WIN32
+	}
+
+	// Threads are spread over the reader slots round robin
+	i32 _thread_reader_slot() {
+		static i32 nextSlot = 0;
+		static thread_local i32 slot = atomic_fetch_add(&nextSlot, 1) % ScalableRWLock::SLOT_COUNT;
+		return slot;
+	}
+
+	// Returns the number of pauses spun
+	i32 _backoff(i32 round) {
+		if (round < SPIN_ROUNDS) {
+			for (i32 i = 0; i < (1 << round); ++i)
+				cpu_relax();
+			return 1 << round;
+		}
+
+		_thread_yield();
+		return 0;
+	}
+
+#if OAK_LOCK_PROFILING
+	struct LockProfileEntry {
+		void *lock;
+		void *name;
+		u64 acquisitionCount;
+		u64 contendedCount;
+		u64 spinCount;
+		u64 totalWaitNs;
+		u64 maxWaitNs;
+	};
+
+	// Open addressed by lock address, entries are never removed so a full table stops recording new locks
+	constexpr i32 LOCK_PROFILE_CAPACITY = 4096;
+	static LockProfileEntry _lockProfiles[LOCK_PROFILE_CAPACITY];
+
+	LockProfileEntry* _lock_profile_entry(void const *lock) {
+		auto key = const_cast<void*>(lock);
+		auto hash = static_cast<u64>(reinterpret_cast<uintptr_t>(lock) >> 2) * 0x9e3779b97f4a7c15;
+		for (i32 i = 0; i < LOCK_PROFILE_CAPACITY; ++i) {
+			auto entry = _lockProfiles + ((hash >> 52) + i) % LOCK_PROFILE_CAPACITY;
+			auto current = atomic_load(&entry->lock);
+			if (current == key)
+				return entry;
+			if (!current && (atomic_compare_exchange(&entry->lock, &current, key) || current == key))
+				return entry;
+		}
+		return nullptr;
+	}
+
+	u64 _now_ns() {
+#ifdef _WIN32
+		LARGE_INTEGER counter, frequency;
+		QueryPerformanceCounter(&counter);
+		QueryPerformanceFrequency(&frequency);
+		return static_cast<u64>(counter.QuadPart) * 1000000000 / static_cast<u64>(frequency.QuadPart);
+#else
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return static_cast<u64>(ts.tv_sec) * 1000000000 + static_cast<u64>(ts.tv_nsec);
+#endif // _WIN32
+	}
+
+	// Times a contended acquisition from the first failed attempt until the lock is held
+	struct ContentionScope {
+		void const *lock;
+		u64 start;
+		u64 spinCount = 0;
+
+		explicit ContentionScope(void const *lock_) : lock{ lock_ }, start{ _now_ns() } {}
+
+		~ContentionScope() {
+			auto entry = _lock_profile_entry(lock);
+			if (!entry)
+				return;
+
+			auto waitNs = _now_ns() - start;
+			atomic_fetch_add<MemoryOrder::RELAXED>(&entry->contendedCount, u64{ 1 });
+			atomic_fetch_add<MemoryOrder::RELAXED>(&entry->spinCount, spinCount);
+			atomic_fetch_add<MemoryOrder::RELAXED>(&entry->totalWaitNs, waitNs);
+			auto maxWaitNs = atomic_load<MemoryOrder::RELAXED>(&entry->maxWaitNs);
+			while (waitNs > maxWaitNs
+					&& !atomic_compare_exchange<MemoryOrder::RELAXED>(&entry->maxWaitNs, &maxWaitNs, waitNs))
+				;
+		}
+
+		void spin(i32 count) {
+			spinCount += static_cast<u64>(count);
+		}
+	};
+#else
+	struct ContentionScope {
+		explicit ContentionScope(void const*) {}
+
+		void spin(i32) {}
+	};
+#endif // OAK_LOCK_PROFILING
+
+}
+
+#if OAK_LOCK_PROFILING
+	void atomic_lock_profile_acquire(void const *lock) noexcept {
+		if (auto entry = _lock_profile_entry(lock))
+			atomic_fetch_add<MemoryOrder::RELAXED>(&entry->acquisitionCount, u64{ 1 });
+	}
+
+	void atomic_lock_profile_name(void const *lock, char const *name) noexcept {
+		if (auto entry = _lock_profile_entry(lock))
+			atomic_set(&entry->name, const_cast<char*>(name));
+	}
+
+	isize atomic_lock_profile_report(LockProfileStats *stats, isize count) noexcept {
+		isize written = 0;
+		for (auto& entry : _lockProfiles) {
+			LockProfileStats lockStats;
+			lockStats.lock = atomic_load(&entry.lock);
+			if (!lockStats.lock)
+				continue;
+			lockStats.name = static_cast<char const*>(atomic_load(&entry.name));
+			lockStats.acquisitionCount = atomic_load<MemoryOrder::RELAXED>(&entry.acquisitionCount);
+			lockStats.contendedCount = atomic_load<MemoryOrder::RELAXED>(&entry.contendedCount);
+			lockStats.spinCount = atomic_load<MemoryOrder::RELAXED>(&entry.spinCount);
+			lockStats.totalWaitNs = atomic_load<MemoryOrder::RELAXED>(&entry.totalWaitNs);
+			lockStats.maxWaitNs = atomic_load<MemoryOrder::RELAXED>(&entry.maxWaitNs);
+
+			// Insertion into the sorted output, only count entries are kept
+			auto pos = written;
+			while (pos > 0 && stats[pos - 1].totalWaitNs < lockStats.totalWaitNs)
+				--pos;
+			if (pos >= count)
+				continue;
+			auto last = written < count ? written : count - 1;
+			for (auto i = last; i > pos; --i)
+				stats[i] = stats[i - 1];
+			stats[pos] = lockStats;
+			if (written < count)
+				++written;
+		}
+
+		return written;
+	}
+
+	// Keeps the addresses and names so registered locks stay named
+	void atomic_lock_profile_reset() noexcept {
+		for (auto& entry : _lockProfiles) {
+			atomic_set<MemoryOrder::RELAXED>(&entry.acquisitionCount, u64{ 0 });
+			atomic_set<MemoryOrder::RELAXED>(&entry.contendedCount, u64{ 0 });
+			atomic_set<MemoryOrder::RELAXED>(&entry.spinCount, u64{ 0 });
+			atomic_set<MemoryOrder::RELAXED>(&entry.totalWaitNs, u64{ 0 });
+			atomic_set<MemoryOrder::RELAXED>(&entry.maxWaitNs, u64{ 0 });
+		}
+	}
+#else
+	void atomic_lock_profile_name(void const*, char const*) noexcept {}
+
+	isize atomic_lock_profile_report(LockProfileStats*, isize) noexcept {
+		return 0;
+	}
+
+	void atomic_lock_profile_reset() noexcept {}
+#endif // OAK_LOCK_PROFILING
+
+	void atomic_wait(i32 *mem, i32 expected) noexcept {
+#ifdef _WIN32
+		WaitOnAddress(mem, &expected, sizeof(expected), INFINITE);
+#elif defined(__linux__)
+		// Not FUTEX_PRIVATE_FLAG, locks can live in arenas shared between processes
+		syscall(SYS_futex, mem, FUTEX_WAIT, expected, nullptr, nullptr, 0);
+#else
+		if (atomic_load(mem) == expected)
+			_thread_yield();
+#endif // _WIN32
+	}
+
+	void atomic_wake_one(i32 *mem) noexcept {
+#ifdef _WIN32
+		WakeByAddressSingle(mem);
+#elif defined(__linux__)
+		syscall(SYS_futex, mem, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#else
+		(void)mem;
+#endif // _WIN32
+	}
+
+	void atomic_wake_all(i32 *mem) noexcept {
+#ifdef _WIN32
+		WakeByAddressAll(mem);
+#elif defined(__linux__)
+		syscall(SYS_futex, mem, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#else
+		(void)mem;
+#endif // _WIN32
+	}
+
+	void atomic_lock_contended(i32 *lock) noexcept {
+		ContentionScope scope{ lock };
+
+		// Most critical sections are short so spin a little before paying for a syscall
+		for (i32 round = 0; round < SPIN_ROUNDS; ++round) {
+			scope.spin(_backoff(round));
+			auto locked = atomic_load(lock);
+			if (locked == 0 && atomic_compare_exchange(lock, &locked, 1))
+				return;
+			if (locked == 2)
+				break;
+		}
+
+		// Taking the lock as 2 is conservative, the unlock may wake a thread that has nothing to do
+		while (atomic_exchange<MemoryOrder::ACQUIRE>(lock, 2) != 0)
+			atomic_wait(lock, 2);
+	}
+
+	void atomic_rw_lock_read_contended(i32 *rwLock) noexcept {
+		ContentionScope scope{ rwLock };
+		for (i32 round = 0;; ++round) {
+			auto locked = atomic_load(rwLock);
+			if (!(locked & (RW_LOCK_WRITER|RW_LOCK_WRITER_WAIT))) {
+				if (atomic_compare_exchange(rwLock, &locked, locked + 1))
+					return;
+				continue;
+			}
+
+			if (round < SPIN_ROUNDS) {
+				scope.spin(_backoff(round));
+				continue;
+			}
+
+			// Flag the wait so the writer knows to wake us once it's done
+			if (!(locked & RW_LOCK_READER_WAIT)
+					&& !atomic_compare_exchange(rwLock, &locked, locked | RW_LOCK_READER_WAIT))
+				continue;
+			atomic_wait(rwLock, locked | RW_LOCK_READER_WAIT);
+		}
+	}
+
+	void atomic_rw_lock_write_contended(i32 *rwLock) noexcept {
+		ContentionScope scope{ rwLock };
+		for (i32 round = 0;; ++round) {
+			auto locked = atomic_load(rwLock);
+			if (!(locked & (RW_LOCK_WRITER|RW_LOCK_READER_MASK))) {
+				// The wait bits are kept, they may belong to other threads that still need a wake up
+				if (atomic_compare_exchange(rwLock, &locked, locked | RW_LOCK_WRITER))
+					return;
+				continue;
+			}
+
+			// Flagging the wait right away stops new readers from getting in ahead of us
+			if (!(locked & RW_LOCK_WRITER_WAIT)) {
+				atomic_compare_exchange(rwLock, &locked, locked | RW_LOCK_WRITER_WAIT);
+				continue;
+			}
+
+			if (round < SPIN_ROUNDS)
+				scope.spin(_backoff(round));
+			else
+				atomic_wait(rwLock, locked);
+		}
+	}
+
+	// Readers publish themselves before checking for a writer and writers do the reverse, sequentially
+	// consistent accesses on both sides keep either from missing the other
+	void atomic_rw_lock_read(ScalableRWLock *rwLock) noexcept {
+		if (atomic_rw_try_lock_read(rwLock))
+			return;
+
+		ContentionScope scope{ rwLock };
+		auto readers = &rwLock->slots[_thread_reader_slot()].readers;
+		for (i32 round = 0;; ++round) {
+			if (round < SPIN_ROUNDS) {
+				scope.spin(_backoff(round));
+			} else {
+				// Writer unlock only wakes when the lock was marked as waited on
+				auto writer = atomic_load(&rwLock->writer);
+				if (writer == 1 && !atomic_compare_exchange(&rwLock->writer, &writer, 2))
+					continue;
+				if (writer)
+					atomic_wait(&rwLock->writer, 2);
+			}
+
+			atomic_fetch_add<MemoryOrder::SEQ_CST>(readers, 1);
+			if (!atomic_load<MemoryOrder::SEQ_CST>(&rwLock->writer)) {
+#if OAK_LOCK_PROFILING
+				atomic_lock_profile_acquire(rwLock);
+#endif
+				return;
+			}
+			atomic_rw_unlock_read(rwLock);
+		}
+	}
+
+	bool atomic_rw_try_lock_read(ScalableRWLock *rwLock) noexcept {
+		auto readers = &rwLock->slots[_thread_reader_slot()].readers;
+		atomic_fetch_add<MemoryOrder::SEQ_CST>(readers, 1);
+		if (!atomic_load<MemoryOrder::SEQ_CST>(&rwLock->writer)) {
+#if OAK_LOCK_PROFILING
+			atomic_lock_profile_acquire(rwLock);
+#endif
+			return true;
+		}
+
+		atomic_rw_unlock_read(rwLock);
+		return false;
+	}
+
+	void atomic_rw_unlock_read(ScalableRWLock *rwLock) noexcept {
+		auto readers = &rwLock->slots[_thread_reader_slot()].readers;
+		[[maybe_unused]] auto oldValue = atomic_fetch_add<MemoryOrder::SEQ_CST>(readers, -1);
+		assert(oldValue > 0 && "unlocked non read locked rw lock");
+		if (oldValue == 1 && atomic_load<MemoryOrder::SEQ_CST>(&rwLock->writer))
+			atomic_wake_all(readers);
+	}
+
+	void atomic_rw_lock_write(ScalableRWLock *rwLock) noexcept {
+		atomic_lock(&rwLock->writer);
+		// Republish the lock word in the single total order the readers check it in
+		atomic_fetch_add<MemoryOrder::SEQ_CST>(&rwLock->writer, 0);
+
+		// New readers back off now, wait for the ones already in to leave
+		for (auto& slot : rwLock->slots) {
+			if (!atomic_load<MemoryOrder::SEQ_CST>(&slot.readers))
+				continue;
+
+			ContentionScope scope{ rwLock };
+			for (i32 round = 0;; ++round) {
+				auto readers = atomic_load<MemoryOrder::SEQ_CST>(&slot.readers);
+				if (!readers)
+					break;
+				if (round < SPIN_ROUNDS)
+					scope.spin(_backoff(round));
+				else
+					atomic_wait(&slot.readers, readers);
+			}
+		}
+	}
+
+	bool atomic_rw_try_lock_write(ScalableRWLock *rwLock) noexcept {
+		if (!atomic_try_lock(&rwLock->writer))
+			return false;
+		atomic_fetch_add<MemoryOrder::SEQ_CST>(&rwLock->writer, 0);
+
+		for (auto& slot : rwLock->slots) {
+			if (atomic_load<MemoryOrder::SEQ_CST>(&slot.readers)) {
+				atomic_rw_unlock_write(rwLock);
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void atomic_rw_unlock_write(ScalableRWLock *rwLock) noexcept {
+		// Waiting readers and writers share the lock word, all of them have to be woken
+		auto oldValue = atomic_exchange<MemoryOrder::RELEASE>(&rwLock->writer, 0);
+		assert(oldValue != 0 && "unlocked non write locked rw lock");
+		if (oldValue == 2)
+			atomic_wake_all(&rwLock->writer);
+	}
+
+}
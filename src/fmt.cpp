@@ -35,6 +35,27 @@ namespace {
 		return str;
 	}
 
+	// Holds any 64 bit integer in base 2 with its sign and the terminator
+	constexpr usize FROM_STR_STACK_SIZE = 66;
+
+	// Calls parse with a null terminated copy of str for the strto* functions. Inputs that fit are copied to
+	// the stack, longer ones to a scratch arena. Without one they are rejected rather than truncated.
+	template<usize stackSize, typename Fn>
+	i64 parse_c_str(String str, Fn&& parse) noexcept {
+		if (str.count < static_cast<i64>(stackSize)) {
+			c8 buffer[stackSize];
+			if (str.count)
+				memcpy(buffer, str.data, str.count);
+			buffer[str.count] = 0;
+			return parse(buffer);
+		}
+
+		auto scratch = get_scratch();
+		if (!scratch.allocator)
+			return -1;
+		return parse(as_c_str(scratch.allocator, str));
+	}
+
 	void sb_buffer_write(void *userData, void const *data, usize size) {
 		static_cast<StringBuffer*>(userData)->write(data, size);
 	}
@@ -169,103 +190,83 @@ namespace {
 	}
 
 	i64 from_str(u8 *v, String str, i32 base) {
-		TMP_ALLOC(66);
-
-		auto cstr = as_c_str(&tmpAlloc, sub_slice(slc(str), 0, 66));
-		c8 *end;
-		*v = static_cast<u8>(strtoul(cstr, &end, base));
-
-		return end - cstr;
+		return parse_c_str<FROM_STR_STACK_SIZE>(str, [&](c8 const *cstr) {
+			c8 *end;
+			*v = static_cast<u8>(strtoul(cstr, &end, base));
+			return end - cstr;
+		});
 	}
 
 	i64 from_str(u16 *v, String str, i32 base) {
-		TMP_ALLOC(66);
-
-		auto cstr = as_c_str(&tmpAlloc, sub_slice(slc(str), 0, 66));
-		c8 *end;
-		*v = static_cast<u16>(strtoul(cstr, &end, base));
-
-		return end - cstr;
+		return parse_c_str<FROM_STR_STACK_SIZE>(str, [&](c8 const *cstr) {
+			c8 *end;
+			*v = static_cast<u16>(strtoul(cstr, &end, base));
+			return end - cstr;
+		});
 	}
 
 	i64 from_str(u32 *v, String str, i32 base) {
-		TMP_ALLOC(66);
-
-		auto cstr = as_c_str(&tmpAlloc, sub_slice(slc(str), 0, 66));
-		c8 *end;
-		*v = static_cast<u32>(strtoul(cstr, &end, base));
-
-		return end - cstr;
+		return parse_c_str<FROM_STR_STACK_SIZE>(str, [&](c8 const *cstr) {
+			c8 *end;
+			*v = static_cast<u32>(strtoul(cstr, &end, base));
+			return end - cstr;
+		});
 	}
 
 	i64 from_str(u64 *v, String str, i32 base) {
-		TMP_ALLOC(66);
-
-		auto cstr = as_c_str(&tmpAlloc, sub_slice(slc(str), 0, 66));
-		c8 *end;
-		*v = strtoull(cstr, &end, base);
-
-		return end - cstr;
+		return parse_c_str<FROM_STR_STACK_SIZE>(str, [&](c8 const *cstr) {
+			c8 *end;
+			*v = strtoull(cstr, &end, base);
+			return end - cstr;
+		});
 	}
 
 	i64 from_str(i8 *v, String str, i32 base) {
-		TMP_ALLOC(66);
-
-		auto cstr = as_c_str(&tmpAlloc, sub_slice(slc(str), 0, 66));
-		c8 *end;
-		*v = static_cast<i8>(strtol(cstr, &end, base));
-
-		return end - cstr;
+		return parse_c_str<FROM_STR_STACK_SIZE>(str, [&](c8 const *cstr) {
+			c8 *end;
+			*v = static_cast<i8>(strtol(cstr, &end, base));
+			return end - cstr;
+		});
 	}
 
 	i64 from_str(i16 *v, String str, i32 base) {
-		TMP_ALLOC(66);
-
-		auto cstr = as_c_str(&tmpAlloc, sub_slice(slc(str), 0, 66));
-		c8 *end;
-		*v = static_cast<i16>(strtol(cstr, &end, base));
-
-		return end - cstr;
+		return parse_c_str<FROM_STR_STACK_SIZE>(str, [&](c8 const *cstr) {
+			c8 *end;
+			*v = static_cast<i16>(strtol(cstr, &end, base));
+			return end - cstr;
+		});
 	}
 
 	i64 from_str(i32 *v, String str, i32 base) {
-		TMP_ALLOC(66);
-
-		auto cstr = as_c_str(&tmpAlloc, sub_slice(slc(str), 0, 66));
-		c8 *end;
-		*v = static_cast<i32>(strtol(cstr, &end, base));
-
-		return end - cstr;
+		return parse_c_str<FROM_STR_STACK_SIZE>(str, [&](c8 const *cstr) {
+			c8 *end;
+			*v = static_cast<i32>(strtol(cstr, &end, base));
+			return end - cstr;
+		});
 	}
 
 	i64 from_str(i64 *v, String str, i32 base) {
-		TMP_ALLOC(66);
-
-		auto cstr = as_c_str(&tmpAlloc, sub_slice(slc(str), 0, 66));
-		c8 *end;
-		*v = strtoll(cstr, &end, base);
-
-		return end - cstr;
+		return parse_c_str<FROM_STR_STACK_SIZE>(str, [&](c8 const *cstr) {
+			c8 *end;
+			*v = strtoll(cstr, &end, base);
+			return end - cstr;
+		});
 	}
 
 	i64 from_str(f32 *v, String str) {
-		TMP_ALLOC(32);
-
-		auto cstr = as_c_str(&tmpAlloc, sub_slice(slc(str), 0, 32));
-		c8 *end;
-		*v = strtof(cstr, &end);
-
-		return end - cstr;
+		return parse_c_str<FROM_STR_STACK_SIZE>(str, [&](c8 const *cstr) {
+			c8 *end;
+			*v = strtof(cstr, &end);
+			return end - cstr;
+		});
 	}
 
 	i64 from_str(f64 *v, String str) {
-		TMP_ALLOC(32);
-
-		auto cstr = as_c_str(&tmpAlloc, sub_slice(slc(str), 0, 32));
-		c8 *end;
-		*v = strtod(cstr, &end);
-
-		return end - cstr;
+		return parse_c_str<FROM_STR_STACK_SIZE>(str, [&](c8 const *cstr) {
+			c8 *end;
+			*v = strtod(cstr, &end);
+			return end - cstr;
+		});
 	}
 
 	i64 from_str(String *v, String str) {
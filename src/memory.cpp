@@ -34,10 +34,18 @@
 #else
 #include <pthread.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #endif // _WIN32
 
+// Older headers lack it, kernels before 5.14 reject it with EINVAL
+#if defined(__linux__) && !defined(MADV_POPULATE_WRITE)
+#define MADV_POPULATE_WRITE 23
+#endif
+
+#include <stdlib.h>
+
 #include <oak_util/atomic.h>
 #include <oak_util/types.h>
 #include <oak_util/ptr.h>
@@ -49,6 +57,30 @@ namespace {
 
 	static thread_local MemoryArena *_threadLocalArena = nullptr;
 
+	struct ScratchArenas {
+		Allocator allocators[2];
+
+		~ScratchArenas() {
+			for (auto& allocator : allocators) {
+				if (allocator.arena)
+					memory_arena_destroy(allocator.arena);
+			}
+		}
+	};
+
+	static thread_local ScratchArenas _threadScratchArenas;
+
+	// Cached reservations are linked through _nextArena towards older entries and through last towards newer ones
+	struct ArenaCache {
+		i32 lock = 0;
+		MemoryArena *first = nullptr;
+		MemoryArena *last = nullptr;
+		usize cachedBytes = 0;
+		usize maxCachedBytes = usize{ 64 } << 20;
+	};
+
+	static ArenaCache _arenaCache;
+
 	usize _get_page_size() {
 #ifdef _WIN32
 		SYSTEM_INFO si;
@@ -62,6 +94,71 @@ namespace {
 #endif
 	}
 
+	struct MemoryBudget {
+		i64 committedMemory = 0;
+		usize maxCommittedMemory = 0;
+
+		i32 lock = 0;
+		MemoryTrimFn trimFns[32] = {};
+		void *trimUserData[32] = {};
+		i32 trimCount = 0;
+
+		char pressurePath[256] = "/proc/pressure/memory";
+		f32 pressureThreshold = 10.f;
+	};
+
+	static MemoryBudget _memoryBudget;
+
+	// Tags are published from different subsystems, one cache line each keeps them from false sharing
+	struct alignas(64) MemoryTagCounter {
+		i64 currentBytes = 0;
+		i64 peakBytes = 0;
+		void *name = nullptr;
+	};
+
+	static MemoryTagCounter _memoryTags[MEMORY_TAG_COUNT];
+
+	void _memory_tag_publish(u32 tag, i64 bytes) {
+		auto counter = _memoryTags + tag;
+		auto current = atomic_fetch_add<MemoryOrder::RELAXED>(&counter->currentBytes, bytes) + bytes;
+		auto peak = atomic_load<MemoryOrder::RELAXED>(&counter->peakBytes);
+		while (current > peak && !atomic_compare_exchange<MemoryOrder::RELAXED>(&counter->peakBytes, &peak, current))
+			;
+	}
+
+	// Each thread accumulates its tag deltas and only touches the shared counters once they grow large
+	struct MemoryTagPending {
+		static constexpr i64 FLUSH_BYTES = 16 << 10;
+
+		i64 bytes[MEMORY_TAG_COUNT] = {};
+
+		void flush() {
+			for (u32 i = 0; i < MEMORY_TAG_COUNT; ++i) {
+				if (bytes[i]) {
+					_memory_tag_publish(i, bytes[i]);
+					bytes[i] = 0;
+				}
+			}
+		}
+
+		~MemoryTagPending() {
+			flush();
+		}
+	};
+
+	static thread_local MemoryTagPending _threadTagPending;
+
+	// Commit sizes are counted in whole pages so commits and decommits of unaligned sizes balance
+	i64 _budget_size(usize size) {
+		static usize pageSize = _get_page_size();
+		return static_cast<i64>(align(size, pageSize));
+	}
+
+	// Shared, file backed, checkpointed and mirrored mappings are made without commit_region and count here
+	void _budget_track(i64 bytes) {
+		atomic_fetch_add<MemoryOrder::RELAXED>(&_memoryBudget.committedMemory, bytes);
+	}
+
 	u64 _get_thread_id() {
 #ifdef _WIN32
 		return GetCurrentThreadId();
@@ -92,18 +189,201 @@ namespace {
 		return addr;
 	}
 
+	void _arena_cache_release(MemoryArenaHeader *header) {
+		auto capacity = header->capacity;
+		decommit_region(header, header->commitSize);
+		virtual_free(header, capacity);
+	}
+
+	// Must hold the cache lock
+	void _arena_cache_unlink(MemoryArenaHeader *header) {
+		auto newer = static_cast<MemoryArenaHeader*>(header->last);
+		auto older = bit_cast<MemoryArenaHeader*>(header->_nextArena);
+		if (newer)
+			newer->_nextArena = header->_nextArena;
+		else
+			_arenaCache.first = header->_nextArena;
+		if (older)
+			older->last = newer;
+		else
+			_arenaCache.last = bit_cast<MemoryArena*>(newer);
+		_arenaCache.cachedBytes -= header->commitSize;
+	}
+
+	// Unlinks the least recently cached reservations until the cache fits in maxCachedBytes, must hold the cache
+	// lock. The victims stay chained through _nextArena so they can be released once the lock is dropped.
+	MemoryArenaHeader* _arena_cache_trim(usize maxCachedBytes) {
+		MemoryArenaHeader *victims = nullptr;
+		while (_arenaCache.cachedBytes > maxCachedBytes) {
+			auto header = bit_cast<MemoryArenaHeader*>(_arenaCache.last);
+			_arena_cache_unlink(header);
+			header->_nextArena = bit_cast<MemoryArena*>(victims);
+			victims = header;
+		}
+		return victims;
+	}
+
+	void _arena_cache_release_list(MemoryArenaHeader *victims) {
+		while (victims) {
+			auto header = victims;
+			victims = bit_cast<MemoryArenaHeader*>(header->_nextArena);
+			_arena_cache_release(header);
+		}
+	}
+
+	bool _arena_cache_put(MemoryArenaHeader *header) {
+		MemoryArenaHeader *victims;
+		{
+			atomic_lock(&_arenaCache.lock);
+			SCOPE_EXIT(atomic_unlock(&_arenaCache.lock));
+
+			if (header->commitSize > _arenaCache.maxCachedBytes)
+				return false;
+
+			_arenaCache.cachedBytes += header->commitSize;
+			header->last = nullptr;
+			header->_nextArena = _arenaCache.first;
+			if (_arenaCache.first)
+				bit_cast<MemoryArenaHeader*>(_arenaCache.first)->last = header;
+			else
+				_arenaCache.last = bit_cast<MemoryArena*>(header);
+			_arenaCache.first = bit_cast<MemoryArena*>(header);
+			victims = _arena_cache_trim(_arenaCache.maxCachedBytes);
+		}
+
+		_arena_cache_release_list(victims);
+		return true;
+	}
+
+	MemoryArenaHeader* _arena_cache_take(usize capacity) {
+		atomic_lock(&_arenaCache.lock);
+		SCOPE_EXIT(atomic_unlock(&_arenaCache.lock));
+
+		for (auto it = _arenaCache.first; it; it = bit_cast<MemoryArenaHeader*>(it)->_nextArena) {
+			auto header = bit_cast<MemoryArenaHeader*>(it);
+			if (header->capacity == capacity) {
+				_arena_cache_unlink(header);
+				return header;
+			}
+		}
+
+		return nullptr;
+	}
+
+	// Size of the headers in front of the first allocation of a plain arena
+	usize _memory_arena_base_size(MemoryArenaHeader *header) {
+		auto size = sizeof(MemoryArenaHeader);
+		if (header->flags & MemoryArenaHeader::SHARED_BIT)
+			size += sizeof(MemorySharedHeader);
+		if (header->flags & MemoryArenaHeader::CHECKPOINTED_BIT)
+			size += sizeof(MemoryCheckpointHeader);
+		if (header->flags & MemoryArenaHeader::FILE_BACKED_BIT)
+			size += sizeof(MemoryFileHeader);
+		// The header page of a checkpointed arena is never remapped so allocations start on the next page
+		if (header->flags & MemoryArenaHeader::CHECKPOINTED_BIT)
+			size = align(size, header->pageSize);
+		return size;
+	}
+
+	MemoryFileHeader* _memory_file_header(MemoryArenaHeader *header) {
+		return static_cast<MemoryFileHeader*>(add_ptr(header, sizeof(MemoryArenaHeader)));
+	}
+
+	// Grows the file before mapping the new pages over the reservation
+	i32 _memory_file_commit([[maybe_unused]] MemoryArenaHeader *header, [[maybe_unused]] usize nCommitSize) {
+#ifdef _WIN32
+		return 1;
+#else
+		auto fd = _memory_file_header(header)->fd;
+		if (ftruncate(fd, static_cast<off_t>(nCommitSize)) == -1)
+			return 1;
+		auto addr = add_ptr(header, header->commitSize);
+		auto size = nCommitSize - header->commitSize;
+		if (mmap(addr, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, static_cast<off_t>(header->commitSize)) == MAP_FAILED)
+			return 1;
+		_budget_track(_budget_size(size));
+#if HAS_ASAN
+		__asan_poison_memory_region(addr, size);
+#endif
+		return 0;
+#endif
+	}
+
 	i32 _memory_arena_ensure_commit_size(MemoryArenaHeader *header, usize nUsedMemory) {
 		if (nUsedMemory > header->commitSize) {
 			auto nCommitSize = ensure_pow2(nUsedMemory);
 			if (nCommitSize > header->capacity)
 				nCommitSize = header->capacity;
-			if (commit_region(add_ptr(header, header->commitSize), nCommitSize - header->commitSize) != 0)
+			if (header->flags & MemoryArenaHeader::FILE_BACKED_BIT) {
+				if (_memory_file_commit(header, nCommitSize) != 0)
+					return 1;
+			} else if (commit_region(add_ptr(header, header->commitSize), nCommitSize - header->commitSize) != 0) {
 				return 1;
+			}
 			header->commitSize = nCommitSize;
 		}
 		return 0;
 	}
 
+	MemoryCheckpointHeader* _memory_checkpoint_header(MemoryArenaHeader *header) {
+		return static_cast<MemoryCheckpointHeader*>(add_ptr(header, sizeof(MemoryArenaHeader)));
+	}
+
+#ifdef __linux__
+	i32 _write_all(i32 fd, void const *addr, usize size, usize offset) {
+		while (size) {
+			auto written = pwrite(fd, addr, size, static_cast<off_t>(offset));
+			if (written <= 0)
+				return 1;
+			addr = add_ptr(addr, static_cast<usize>(written));
+			size -= static_cast<usize>(written);
+			offset += static_cast<usize>(written);
+		}
+		return 0;
+	}
+
+	// Writes the pages copied on write since the last checkpoint back to the memfd, falls back to writing
+	// the whole used region when the page map can't be read. The shared header page is skipped.
+	i32 _memory_checkpoint_flush(MemoryArenaHeader *header, i32 fd) {
+		auto pageSize = header->pageSize;
+		auto pageCount = align(header->usedMemory, pageSize) / pageSize;
+
+#if HAS_ASAN
+		__asan_unpoison_memory_region(add_ptr(header, pageSize), (pageCount - 1) * pageSize);
+#endif
+
+		auto pagemap = open("/proc/self/pagemap", O_RDONLY|O_CLOEXEC);
+		if (pagemap == -1)
+			return _write_all(fd, add_ptr(header, pageSize), (pageCount - 1) * pageSize, pageSize);
+		SCOPE_EXIT(close(pagemap));
+
+		constexpr u64 PRESENT_BIT = u64{ 1 } << 63;
+		constexpr u64 SWAPPED_BIT = u64{ 1 } << 62;
+		constexpr u64 FILE_BIT = u64{ 1 } << 61;
+
+		u64 entries[512];
+		auto firstPage = reinterpret_cast<uintptr_t>(header) / pageSize;
+		for (usize page = 1; page < pageCount; page += 512) {
+			auto count = pageCount - page < 512 ? pageCount - page : 512;
+			auto bytes = static_cast<ssize_t>(count * sizeof(u64));
+			if (pread(pagemap, entries, bytes, static_cast<off_t>((firstPage + page) * sizeof(u64))) != bytes)
+				return _write_all(fd, add_ptr(header, pageSize), (pageCount - 1) * pageSize, pageSize);
+
+			for (usize i = 0; i < count; ++i) {
+				// Private copies are anonymous pages, untouched pages still map the file
+				auto entry = entries[i];
+				if (!(entry & (PRESENT_BIT|SWAPPED_BIT)) || (entry & FILE_BIT))
+					continue;
+				auto offset = (page + i) * pageSize;
+				if (_write_all(fd, add_ptr(header, offset), pageSize, offset) != 0)
+					return 1;
+			}
+		}
+
+		return 0;
+	}
+#endif // __linux__
+
 	MemoryArena* _require_thread_local_arena(MTMemoryArenaHeader *header) {
 		if (_threadLocalArena)
 			return _threadLocalArena;
@@ -128,6 +408,7 @@ namespace {
 			return nullptr;
 
 		bit_cast<MemoryArenaHeader*>(_threadLocalArena)->_threadId = threadId;
+		bit_cast<MemoryArenaHeader*>(_threadLocalArena)->_epoch = atomic_load(&header->epoch);
 
 		atomic_lock(&header->_lock);
 		SCOPE_EXIT(atomic_unlock(&header->_lock));
@@ -141,333 +422,2516 @@ namespace {
 		return _threadLocalArena;
 	}
 
-	isize _memory_heap_pool_idx(
-			usize *objectSize,
-			MemoryHeapHeader *heapHeader,
-			usize size,
-			[[maybe_unused]] usize alignment) {
-		auto pow2Size = ensure_pow2(size);
-		if (pow2Size < heapHeader->minPoolObjectSize)
-			pow2Size = heapHeader->minPoolObjectSize;
-		*objectSize = pow2Size;
+	// Lazily clears the thread arena the first time it is used in a new epoch, every path that can hand out
+	// memory has to run this first or the next call clears the arena under the block
+	void _mt_memory_arena_sync_epoch(MTMemoryArenaHeader *header, MemoryArena *localArena) {
+		auto localHeader = bit_cast<MemoryArenaHeader*>(localArena);
+		auto epoch = atomic_load(&header->epoch);
+		if (localHeader->_epoch != epoch) {
+			memory_arena_clear(localArena);
+			localHeader->_epoch = epoch;
+		}
+	}
 
-		assert(alignment <= pow2Size);
+	struct MemoryStackSpill {
+		MemoryStackSpill *prev;
+		MemoryStackSpill *next;
+		usize size;
+		usize offset;
+	};
 
-		isize poolIdxOffset = blog2(heapHeader->minPoolObjectSize);
-		isize maxPoolIdx = blog2(heapHeader->maxPoolObjectSize) - poolIdxOffset;
-		isize poolIdx = blog2(pow2Size) - poolIdxOffset;
+	MemoryStackHeader* _memory_stack_header(MemoryArena *arena) {
+		return static_cast<MemoryStackHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
+	}
 
-		assert(poolIdx >= 0);
-		if (poolIdx > maxPoolIdx)
-			poolIdx = -1;
+	bool _memory_stack_owns(MemoryArenaHeader *header, void *addr) {
+		return addr >= static_cast<void*>(header) && addr < add_ptr(header, header->capacity);
+	}
 
-		return poolIdx;
+	MemoryStackSpill* _memory_stack_spill_of(void *addr) {
+		return static_cast<MemoryStackSpill*>(sub_ptr(addr, ssizeof(MemoryStackSpill)));
 	}
 
-	void* _memory_heap_alloc_pages(MemoryArenaHeader *header, usize size) {
-		auto offset = align(header->usedMemory, header->pageSize);
-		auto alignedSize = align(size, header->pageSize);
-		if (offset + alignedSize > header->capacity)
-			return nullptr;
+	MemoryRingHeader* _memory_ring_header(MemoryArena *arena) {
+		return static_cast<MemoryRingHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
+	}
 
-		if (_memory_arena_ensure_commit_size(header, offset + alignedSize) != 0)
-			return nullptr;
+	// Returns the position an allocation of size bytes would start at or ~0 if the ring is full
+	u64 _memory_ring_place(MemoryArenaHeader *header, MemoryRingHeader *ringHeader, u64 pos, usize size) {
+		if (!(header->flags & MemoryArenaHeader::MIRRORED_BIT) && pos % ringHeader->ringSize + size > ringHeader->ringSize)
+			pos = align(pos, ringHeader->ringSize);
+
+		// Nothing is live so the skipped space doesn't need to be kept around
+		auto tail = ringHeader->tail == ringHeader->head ? pos : ringHeader->tail;
+		if (pos + size - tail > ringHeader->ringSize)
+			return ~u64{ 0 };
+
+		if (!(header->flags & MemoryArenaHeader::MIRRORED_BIT)) {
+			auto end = ptr_diff(ringHeader->ring, header) + pos % ringHeader->ringSize + size;
+			if (_memory_arena_ensure_commit_size(header, end) != 0)
+				return ~u64{ 0 };
+		}
+
+		ringHeader->tail = tail;
+		return pos;
+	}
 
-		header->usedMemory = offset + alignedSize;
+	void _memory_ring_poison(
+			[[maybe_unused]] MemoryRingHeader *ringHeader, [[maybe_unused]] u64 from, [[maybe_unused]] u64 to) {
 #if HAS_ASAN
-		__asan_unpoison_memory_region(add_ptr(header, offset), alignedSize);
+		while (from < to) {
+			auto offset = from % ringHeader->ringSize;
+			auto count = ringHeader->ringSize - offset;
+			if (count > to - from)
+				count = to - from;
+			__asan_poison_memory_region(add_ptr(ringHeader->ring, offset), count);
+			from += count;
+		}
 #endif
-
-		return add_ptr(header, offset);
 	}
 
-}
+	MemoryBuddyHeader* _memory_buddy_header(MemoryArena *arena) {
+		return static_cast<MemoryBuddyHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
+	}
 
-	void* virtual_alloc(usize size) {
-#ifdef _WIN32
-		return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_READWRITE);
-#else
-		auto result = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-		if (result == MAP_FAILED)
-			return nullptr;
+	i32 _memory_buddy_order(MemoryBuddyHeader *buddyHeader, usize size) {
+		if (size < buddyHeader->minBlockSize)
+			size = buddyHeader->minBlockSize;
+		return static_cast<i32>(blog2(ensure_pow2(size) / buddyHeader->minBlockSize));
+	}
 
-		return result;
-#endif // _WIN32
+	// First node of the tree level that holds blocks of the given order
+	isize _memory_buddy_level_start(MemoryBuddyHeader *buddyHeader, i32 order) {
+		return (isize{ 1 } << (buddyHeader->maxOrder - order)) - 1;
 	}
 
-	bool virtual_try_grow(void *addr, [[maybe_unused]] usize size, usize newSize) {
-#ifdef _WIN32
-		auto result = VirtualAlloc(addr, newSize, MEM_RESERVE, PAGE_READWRITE);
-		if (result == nullptr)
-			return false;
-		if (result != addr) {
-			VirtualFree(result, 0, MEM_RELEASE);
-			return false;
+	void _memory_buddy_reset_tree(MemoryBuddyHeader *buddyHeader) {
+		for (i32 order = buddyHeader->maxOrder; order >= 0; --order) {
+			auto start = _memory_buddy_level_start(buddyHeader, order);
+			memset(buddyHeader->orderTree + start, order + 1, start + 1);
 		}
+	}
 
-		return true;
-#else
-		auto nAddr = add_ptr(addr, size);
-		auto result = mmap(nAddr, newSize - size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-		if (result == MAP_FAILED)
-			return false;
-		if (result != nAddr) {
-			munmap(result, newSize - size);
-			return false;
+	i32 _memory_buddy_commit(MemoryArenaHeader *header, MemoryBuddyHeader *buddyHeader, isize leaf, isize leafCount) {
+		auto bits = buddyHeader->commitBits;
+		isize i = leaf;
+		while (i < leaf + leafCount) {
+			if (bits[i >> 6] & (u64{ 1 } << (i & 63))) {
+				++i;
+				continue;
+			}
+
+			auto start = i;
+			while (i < leaf + leafCount && !(bits[i >> 6] & (u64{ 1 } << (i & 63))))
+				++i;
+
+			if (commit_region(
+						add_ptr(buddyHeader->blocks, start*buddyHeader->minBlockSize),
+						(i - start)*buddyHeader->minBlockSize) != 0)
+				return 1;
+
+			for (auto j = start; j < i; ++j)
+				bits[j >> 6] |= u64{ 1 } << (j & 63);
+			header->commitSize += (i - start)*buddyHeader->minBlockSize;
 		}
 
-		return true;
-#endif // _WIN32
+		return 0;
 	}
 
-	void virtual_free(void *addr, usize size) {
-#ifdef _WIN32
-		(void)size;
-		auto result = VirtualFree(addr, 0, MEM_RELEASE);
-		assert(result);
-#else
-		[[maybe_unused]] auto result = munmap(addr, size);
-		assert(result == 0);
-#endif // _WIN32
+	struct HandleBlock {
+		static constexpr u32 DEAD_SLOT = ~u32{ 0 };
+		// What a compaction step charges against its budget for visiting a block, moved or not
+		static constexpr usize SCAN_COST = 64;
+
+		u32 slot;
+		u32 pad;
+		// Size of the whole block, header included
+		u64 size;
+	};
+
+	constexpr usize HANDLE_ALIGN = 16;
+	static_assert(sizeof(HandleBlock) == HANDLE_ALIGN);
+
+	MemoryHandleHeader* _memory_handle_header(MemoryArena *arena) {
+		return static_cast<MemoryHandleHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
 	}
 
-	i32 commit_region(void *addr, usize size) {
-#ifdef _WIN32
-		auto result = VirtualAlloc(addr, size, MEM_COMMIT, PAGE_READWRITE);
-		if (result == nullptr)
-			return 1;
+	HandleBlock* _handle_block(MemoryHandleHeader *handleHeader, usize offset) {
+		return static_cast<HandleBlock*>(add_ptr(handleHeader->blocks, offset));
+	}
+
+	void _handle_poison([[maybe_unused]] MemoryHandleHeader *handleHeader, [[maybe_unused]] usize from, [[maybe_unused]] usize to) {
 #if HAS_ASAN
-		__asan_poison_memory_region(addr, size);
-#endif
-		return 0;
-#else
-		if (mprotect(addr, size, PROT_READ|PROT_WRITE) == -1)
-			return 1;
-		ASAN_POISON_MEMORY_REGION(addr, size);
-		return 0;
+		if (from < to)
+			__asan_poison_memory_region(add_ptr(handleHeader->blocks, from), to - from);
 #endif
 	}
 
-	i32 decommit_region(void *addr, usize size) {
-#ifdef _WIN32
+	void _handle_unpoison([[maybe_unused]] MemoryHandleHeader *handleHeader, [[maybe_unused]] usize from, [[maybe_unused]] usize to) {
 #if HAS_ASAN
-		__asan_unpoison_memory_region(addr, size);
-#endif
-		if (VirtualFree(addr, size, MEM_DECOMMIT) == 0)
-			return 1;
-		return 0;
-#else
-		ASAN_UNPOISON_MEMORY_REGION(addr, size);
-		if (mprotect(addr, size, PROT_NONE) == -1)
-			return 1;
-		if (madvise(addr, size, MADV_DONTNEED) == -1)
-			return 1;
-		return 0;
+		if (from < to)
+			__asan_unpoison_memory_region(add_ptr(handleHeader->blocks, from), to - from);
 #endif
 	}
 
-	i32 memory_arena_init(MemoryArena **arena, usize size) {
-		usize pageSize;
-		auto addr = _virtual_alloc_with_header(size, sizeof(MemoryArenaHeader), &pageSize);
-		if (!addr)
-			return 1;
-
-		auto header = static_cast<MemoryArenaHeader*>(addr);
-		header->capacity = size;
-		header->usedMemory = sizeof(MemoryArenaHeader);
-		header->commitSize = pageSize;
-		header->pageSize = pageSize;
-		header->next = nullptr;
-		header->last = nullptr;
-		header->alignSize = 1;
-		header->flags = 0;
-
-		header->allocationCount = 0;
-		header->requestedMemory = 0;
-
-		header->_lock = 0;
-		header->_nextArena = nullptr;
-		header->_threadId = 0;
-
-		*arena = static_cast<MemoryArena*>(addr);
+	struct TlsfBlock {
+		enum FlagBits : usize {
+			FREE_BIT = 0x1,
+			PREV_FREE_BIT = 0x2,
+		};
 
-		return 0;
+		// Payload size in the upper bits, flags in the lower bits
+		usize size;
+		TlsfBlock *prevPhys;
+		// Only valid while the block is free, they overlap the payload
+		TlsfBlock *nextFree;
+		TlsfBlock *prevFree;
+	};
+
+	constexpr usize TLSF_ALIGN_LOG2 = 4;
+	constexpr usize TLSF_ALIGN = usize{ 1 } << TLSF_ALIGN_LOG2;
+	constexpr usize TLSF_SL_LOG2 = 5;
+	constexpr usize TLSF_FL_SHIFT = TLSF_SL_LOG2 + TLSF_ALIGN_LOG2;
+	constexpr usize TLSF_SMALL_SIZE = usize{ 1 } << TLSF_FL_SHIFT;
+	constexpr usize TLSF_HEADER_SIZE = offsetof(TlsfBlock, nextFree);
+	constexpr usize TLSF_MIN_PAYLOAD = sizeof(TlsfBlock) - TLSF_HEADER_SIZE;
+	constexpr usize TLSF_FLAG_MASK = TLSF_ALIGN - 1;
+
+	static_assert(TLSF_HEADER_SIZE == TLSF_ALIGN && TLSF_MIN_PAYLOAD == TLSF_ALIGN);
+	static_assert(MemoryTlsfHeader::SL_COUNT == (1 << TLSF_SL_LOG2));
+
+	MemoryTlsfHeader* _memory_tlsf_header(MemoryArena *arena) {
+		return static_cast<MemoryTlsfHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
 	}
 
-	i32 memory_arena_init(MemoryArena **arena, void *addr, usize size) {
-		if (size < sizeof(MemoryArenaHeader))
-			return 1;
+	usize _tlsf_size(TlsfBlock *block) {
+		return block->size & ~TLSF_FLAG_MASK;
+	}
 
-		// Allocate the header
-		auto header = static_cast<MemoryArenaHeader*>(addr);
-		header->capacity = size;
-		header->usedMemory = sizeof(MemoryArenaHeader);
-		header->commitSize = size;
-		header->pageSize = _get_page_size();
-		header->next = nullptr;
-		header->last = nullptr;
-		header->alignSize = 1;
-		header->flags = MemoryArenaHeader::SUB_ALLOCATED_BIT;
+	void* _tlsf_payload(TlsfBlock *block) {
+		return add_ptr(block, TLSF_HEADER_SIZE);
+	}
 
-		header->allocationCount = 0;
-		header->requestedMemory = 0;
+	TlsfBlock* _tlsf_block_of(void *addr) {
+		return static_cast<TlsfBlock*>(sub_ptr(addr, TLSF_HEADER_SIZE));
+	}
 
-		header->_lock = 0;
-		header->_nextArena = nullptr;
-		header->_threadId = 0;
+	TlsfBlock* _tlsf_next_phys(TlsfBlock *block) {
+		return static_cast<TlsfBlock*>(add_ptr(_tlsf_payload(block), _tlsf_size(block)));
+	}
 
+	TlsfBlock* _tlsf_make_block(void *addr) {
 #if HAS_ASAN
-		__asan_poison_memory_region(add_ptr(addr, sizeof(MemoryArenaHeader)), size - sizeof(MemoryArenaHeader));
+		__asan_unpoison_memory_region(addr, sizeof(TlsfBlock));
 #endif
-
-		*arena = static_cast<MemoryArena*>(addr);
-
-		return 0;
+		return static_cast<TlsfBlock*>(addr);
 	}
 
-	void memory_arena_align_size(MemoryArena *arena, usize alignSize) {
+	void _tlsf_mapping(usize size, i32 *fl, i32 *sl) {
+		if (size < TLSF_SMALL_SIZE) {
+			*fl = 0;
+			*sl = static_cast<i32>(size / (TLSF_SMALL_SIZE / MemoryTlsfHeader::SL_COUNT));
+		} else {
+			auto log2 = blog2(static_cast<u64>(size));
+			*sl = static_cast<i32>((size >> (log2 - TLSF_SL_LOG2)) ^ (usize{ 1 } << TLSF_SL_LOG2));
+			*fl = static_cast<i32>(log2 - (TLSF_FL_SHIFT - 1));
+		}
+	}
+
+	void _tlsf_insert(MemoryTlsfHeader *tlsfHeader, TlsfBlock *block) {
+		i32 fl, sl;
+		_tlsf_mapping(_tlsf_size(block), &fl, &sl);
+		assert(fl < MemoryTlsfHeader::FL_COUNT);
+
+		auto head = static_cast<TlsfBlock*>(tlsfHeader->freeLists[fl][sl]);
+		block->nextFree = head;
+		block->prevFree = nullptr;
+		if (head)
+			head->prevFree = block;
+		tlsfHeader->freeLists[fl][sl] = block;
+		tlsfHeader->flBitmap |= u32{ 1 } << fl;
+		tlsfHeader->slBitmaps[fl] |= u32{ 1 } << sl;
+	}
+
+	void _tlsf_remove(MemoryTlsfHeader *tlsfHeader, TlsfBlock *block) {
+		i32 fl, sl;
+		_tlsf_mapping(_tlsf_size(block), &fl, &sl);
+
+		if (block->prevFree)
+			block->prevFree->nextFree = block->nextFree;
+		else
+			tlsfHeader->freeLists[fl][sl] = block->nextFree;
+		if (block->nextFree)
+			block->nextFree->prevFree = block->prevFree;
+
+		if (!tlsfHeader->freeLists[fl][sl]) {
+			tlsfHeader->slBitmaps[fl] &= ~(u32{ 1 } << sl);
+			if (!tlsfHeader->slBitmaps[fl])
+				tlsfHeader->flBitmap &= ~(u32{ 1 } << fl);
+		}
+	}
+
+	TlsfBlock* _tlsf_find(MemoryTlsfHeader *tlsfHeader, usize size) {
+		// Round up to the next list so any block found is large enough without searching the list
+		if (size >= TLSF_SMALL_SIZE)
+			size += (usize{ 1 } << (blog2(static_cast<u64>(size)) - TLSF_SL_LOG2)) - 1;
+
+		i32 fl, sl;
+		_tlsf_mapping(size, &fl, &sl);
+		if (fl >= MemoryTlsfHeader::FL_COUNT)
+			return nullptr;
+
+		u32 slMap = tlsfHeader->slBitmaps[fl] & (~u32{ 0 } << sl);
+		if (!slMap) {
+			if (fl + 1 >= MemoryTlsfHeader::FL_COUNT)
+				return nullptr;
+			u32 flMap = tlsfHeader->flBitmap & (~u32{ 0 } << (fl + 1));
+			if (!flMap)
+				return nullptr;
+			fl = ctz(flMap);
+			slMap = tlsfHeader->slBitmaps[fl];
+		}
+		sl = ctz(slMap);
+
+		return static_cast<TlsfBlock*>(tlsfHeader->freeLists[fl][sl]);
+	}
+
+	// Splits the tail of a used block off into a new free block if it is big enough to hold one
+	void _tlsf_trim(MemoryTlsfHeader *tlsfHeader, TlsfBlock *block, usize size) {
+		auto blockSize = _tlsf_size(block);
+		if (blockSize < size + TLSF_HEADER_SIZE + TLSF_MIN_PAYLOAD)
+			return;
+
+		auto next = _tlsf_next_phys(block);
+		auto rest = _tlsf_make_block(add_ptr(_tlsf_payload(block), size));
+		block->size = size | (block->size & TLSF_FLAG_MASK);
+		rest->size = (blockSize - size - TLSF_HEADER_SIZE) | TlsfBlock::FREE_BIT;
+		rest->prevPhys = block;
+
+		if (next->size & TlsfBlock::FREE_BIT) {
+			_tlsf_remove(tlsfHeader, next);
+			rest->size += _tlsf_size(next) + TLSF_HEADER_SIZE;
+			next = _tlsf_next_phys(rest);
+		}
+		next->prevPhys = rest;
+		next->size |= TlsfBlock::PREV_FREE_BIT;
+
+		_tlsf_insert(tlsfHeader, rest);
+	}
+
+	void _tlsf_reset(MemoryArenaHeader *header, MemoryTlsfHeader *tlsfHeader) {
+		tlsfHeader->flBitmap = 0;
+		memset(tlsfHeader->slBitmaps, 0, sizeof(tlsfHeader->slBitmaps));
+		memset(tlsfHeader->freeLists, 0, sizeof(tlsfHeader->freeLists));
+
+		// One free block spanning the region followed by a zero sized used sentinel
+		auto regionSize = header->capacity - ptr_diff(tlsfHeader->blocks, header);
+		auto block = _tlsf_make_block(tlsfHeader->blocks);
+		block->size = (regionSize - 2*TLSF_HEADER_SIZE) | TlsfBlock::FREE_BIT;
+		block->prevPhys = nullptr;
+
+		auto sentinel = _tlsf_make_block(_tlsf_next_phys(block));
+		sentinel->size = TlsfBlock::PREV_FREE_BIT;
+		sentinel->prevPhys = block;
+
+		_tlsf_insert(tlsfHeader, block);
+	}
+
+	struct SysSpan {
+		void *next;
+		usize size;
+	};
+
+	MemorySysHeader* _memory_sys_header(MemoryArena *arena) {
+		return static_cast<MemorySysHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
+	}
+
+	isize _sys_span_bucket(MemoryArenaHeader *header, MemorySysHeader *sysHeader, usize size) {
+		auto bucket = static_cast<isize>(blog2(static_cast<u64>(size / header->pageSize)));
+		auto lastBucket = sarray_count(sysHeader->spanBuckets) - 1;
+		return bucket < lastBucket ? bucket : lastBucket;
+	}
+
+	// Lets the os reclaim the pages whenever it wants while keeping the mapping around
+	void _sys_span_release_lazily(void *addr, usize size) {
+#ifdef _WIN32
+		VirtualAlloc(addr, size, MEM_RESET, PAGE_READWRITE);
+#elif defined(MADV_FREE)
+		madvise(addr, size, MADV_FREE);
+#else
+		madvise(addr, size, MADV_DONTNEED);
+#endif
+	}
+
+	// Faults committed pages in ahead of time so the first write to them doesn't happen inside an allocation
+	void _prefault_region(void *addr, usize size, usize pageSize) {
+#ifdef __linux__
+		if (madvise(addr, size, MADV_POPULATE_WRITE) == 0)
+			return;
+#endif
+#if HAS_ASAN
+		__asan_unpoison_memory_region(addr, size);
+#endif
+		for (usize offset = 0; offset < size; offset += pageSize)
+			static_cast<u8 volatile*>(addr)[offset] = 0;
+#if HAS_ASAN
+		__asan_poison_memory_region(addr, size);
+#endif
+	}
+
+	struct HeapRemoteFree {
+		void *next;
+		usize size;
+	};
+
+	void _memory_arena_set_thread_owned(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		header->flags |= MemoryArenaHeader::THREAD_OWNED_BIT;
+		header->_threadId = _get_thread_id();
+		header->_epoch = 0;
+	}
+
+	bool _memory_arena_is_owner(MemoryArenaHeader *header) {
+		return (header->flags & MemoryArenaHeader::THREAD_OWNED_BIT) && header->_threadId == _get_thread_id();
+	}
+
+	// Pushes a node whose first word is its next pointer, the owner takes the whole list at once so there is no ABA
+	void _remote_free_push(void **list, void *addr) {
+		auto head = atomic_load(list);
+		do {
+			*static_cast<void**>(addr) = head;
+		} while (!atomic_compare_exchange(list, &head, addr));
+	}
+
+	// Moves the remote frees of a pool onto its empty free list and takes them out of the stats
+	void* _memory_heap_collect(MemoryHeapHeader *heapHeader, isize poolIdx) {
+		auto pool = heapHeader->pools + poolIdx;
+		auto batch = atomic_exchange<MemoryOrder::ACQUIRE>(heapHeader->remoteFreeLists + poolIdx, nullptr);
+		for (auto it = batch; it;) {
+			auto node = static_cast<HeapRemoteFree*>(it);
+			--pool->allocationCount;
+			pool->requestedMemory -= node->size;
+			it = node->next;
+#if HAS_ASAN
+			__asan_poison_memory_region(node, sizeof(HeapRemoteFree));
+#endif
+		}
+		pool->freeList = batch;
+		return batch;
+	}
+
+	isize _memory_heap_pool_idx(
+			usize *objectSize,
+			MemoryHeapHeader *heapHeader,
+			usize size,
+			[[maybe_unused]] usize alignment) {
+		auto pow2Size = ensure_pow2(size);
+		if (pow2Size < heapHeader->minPoolObjectSize)
+			pow2Size = heapHeader->minPoolObjectSize;
+		*objectSize = pow2Size;
+
+		assert(alignment <= pow2Size);
+
+		isize poolIdxOffset = blog2(heapHeader->minPoolObjectSize);
+		isize maxPoolIdx = blog2(heapHeader->maxPoolObjectSize) - poolIdxOffset;
+		isize poolIdx = blog2(pow2Size) - poolIdxOffset;
+
+		assert(poolIdx >= 0);
+		if (poolIdx > maxPoolIdx)
+			poolIdx = -1;
+
+		return poolIdx;
+	}
+
+	[[maybe_unused]] bool _memory_heap_owns(MemoryArenaHeader *header, MemoryHeapHeader *heapHeader, void *addr) {
+		if (addr > static_cast<void*>(header) && addr < add_ptr(header, header->capacity))
+			return true;
+		for (i32 i = 0; i < heapHeader->segmentCount; ++i) {
+			auto segment = heapHeader->segments + i;
+			if (addr >= segment->base && addr < add_ptr(segment->base, segment->capacity))
+				return true;
+		}
+		return false;
+	}
+
+	// Extends the last reservation of the heap in place so it fits required bytes
+	bool _memory_heap_try_grow(
+			MemoryArenaHeader *header, MemoryHeapHeader *heapHeader, void *base, usize *capacity, usize required) {
+		auto newCapacity = *capacity * 2;
+		if (newCapacity < required)
+			newCapacity = required;
+		newCapacity = align(newCapacity, header->pageSize);
+
+		auto budget = heapHeader->maxSize - heapHeader->reservedSize + *capacity;
+		if (newCapacity > budget)
+			newCapacity = budget - budget % header->pageSize;
+		if (newCapacity < required || newCapacity <= *capacity)
+			return false;
+
+		if (!virtual_try_grow(base, *capacity, newCapacity))
+			return false;
+
+		heapHeader->reservedSize += newCapacity - *capacity;
+		*capacity = newCapacity;
+		return true;
+	}
+
+	i32 _memory_heap_add_segment(MemoryArenaHeader *header, MemoryHeapHeader *heapHeader, usize required) {
+		if (heapHeader->segmentCount == sarray_count(heapHeader->segments))
+			return 1;
+
+		auto size = heapHeader->segmentCount
+			? heapHeader->segments[heapHeader->segmentCount - 1].capacity * 2
+			: header->capacity * 2;
+		if (size < required)
+			size = required;
+		size = align(size, header->pageSize);
+
+		auto budget = heapHeader->maxSize - heapHeader->reservedSize;
+		if (size > budget)
+			size = budget - budget % header->pageSize;
+		if (size < required)
+			return 1;
+
+		auto base = virtual_alloc(size);
+		if (!base)
+			return 1;
+#if HAS_ASAN
+		__asan_poison_memory_region(base, size);
+#endif
+
+		auto segment = heapHeader->segments + heapHeader->segmentCount++;
+		segment->base = base;
+		segment->capacity = size;
+		segment->usedMemory = 0;
+		segment->commitSize = 0;
+		segment->freshOffset = 0;
+		heapHeader->reservedSize += size;
+
+		return 0;
+	}
+
+	// Carves pages off the active reservation, growing the heap when it runs out, fresh is set when the pages
+	// have never been handed out before
+	void* _memory_heap_alloc_pages(MemoryArenaHeader *header, MemoryHeapHeader *heapHeader, usize size, bool *fresh) {
+		auto alignedSize = align(size, header->pageSize);
+		for (;;) {
+			auto isLast = heapHeader->activeSegment == heapHeader->segmentCount;
+			if (heapHeader->activeSegment == 0) {
+				auto offset = align(header->usedMemory, header->pageSize);
+				auto required = offset + alignedSize;
+				if (required <= header->capacity
+						|| (isLast && _memory_heap_try_grow(header, heapHeader, header, &header->capacity, required))) {
+					if (_memory_arena_ensure_commit_size(header, required) != 0)
+						return nullptr;
+
+					header->usedMemory = required;
+					*fresh = offset >= heapHeader->freshOffset;
+					if (required > heapHeader->freshOffset)
+						heapHeader->freshOffset = required;
+#if HAS_ASAN
+					__asan_unpoison_memory_region(add_ptr(header, offset), alignedSize);
+#endif
+					return add_ptr(header, offset);
+				}
+			} else {
+				auto segment = heapHeader->segments + heapHeader->activeSegment - 1;
+				auto offset = segment->usedMemory;
+				auto required = offset + alignedSize;
+				if (required <= segment->capacity
+						|| (isLast && _memory_heap_try_grow(header, heapHeader, segment->base, &segment->capacity, required))) {
+					if (required > segment->commitSize) {
+						auto nCommitSize = ensure_pow2(required);
+						if (nCommitSize > segment->capacity)
+							nCommitSize = segment->capacity;
+						if (commit_region(add_ptr(segment->base, segment->commitSize), nCommitSize - segment->commitSize) != 0)
+							return nullptr;
+						segment->commitSize = nCommitSize;
+					}
+
+					segment->usedMemory = required;
+					*fresh = offset >= segment->freshOffset;
+					if (required > segment->freshOffset)
+						segment->freshOffset = required;
+#if HAS_ASAN
+					__asan_unpoison_memory_region(add_ptr(segment->base, offset), alignedSize);
+#endif
+					return add_ptr(segment->base, offset);
+				}
+			}
+
+			if (isLast && _memory_heap_add_segment(header, heapHeader, alignedSize) != 0)
+				return nullptr;
+			++heapHeader->activeSegment;
+		}
+	}
+
+	void* _memory_heap_alloc(MemoryArena *arena, usize size, usize alignment, bool zeroed) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto heapHeader = static_cast<MemoryHeapHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
+
+		assert(alignment <= header->pageSize);
+		assert(sizeof(void*) <= heapHeader->minPoolObjectSize);
+
+		usize objectSize;
+		isize poolIdx = _memory_heap_pool_idx(&objectSize, heapHeader, size, alignment);
+		assert(size <= objectSize);
+		assert(heapHeader->minPoolObjectSize <= objectSize && objectSize <= heapHeader->maxPoolObjectSize);
+
+		[[maybe_unused]] usize alignedSize = align(size, sizeof(void*));
+
+		if (poolIdx < 0)
+			return nullptr;
+		assert(poolIdx < sarray_count(heapHeader->pools));
+
+		auto pool = heapHeader->pools + poolIdx;
+		auto threadOwned = header->flags & MemoryArenaHeader::THREAD_OWNED_BIT;
+		assert((!threadOwned || _memory_arena_is_owner(header)) && "thread owned heap allocated from by another thread");
+		if (!threadOwned)
+			atomic_lock(&pool->_lock);
+		SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&pool->_lock););
+
+		void *addr = pool->freeList;
+		if (!addr && threadOwned && atomic_load(heapHeader->remoteFreeLists + poolIdx))
+			addr = _memory_heap_collect(heapHeader, poolIdx);
+		if (addr) {
+			assert(_memory_heap_owns(header, heapHeader, addr));
+#if HAS_ASAN
+			__asan_unpoison_memory_region(addr, alignedSize);
+#endif
+			pool->freeList = *static_cast<void**>(addr);
+			if (zeroed)
+				memset(addr, 0, size);
+		} else {
+			if (!pool->pageCursor || pool->pageCursor == pool->pageEnd) {
+				usize heapPageSize = heapHeader->heapSmallPageSize;
+				if (size > heapHeader->heapSmallPageSize >> 1)
+					heapPageSize = heapHeader->heapLargePageSize;
+				assert(heapPageSize == align(heapPageSize, header->pageSize));
+				assert(objectSize < heapPageSize && heapPageSize % objectSize == 0);
+
+				bool fresh;
+				void *page;
+				{
+					if (!threadOwned)
+						atomic_lock(&header->_lock);
+					SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&header->_lock););
+
+					page = _memory_heap_alloc_pages(header, heapHeader, heapPageSize, &fresh);
+				}
+				if (!page)
+					return nullptr;
+#if HAS_ASAN
+				__asan_poison_memory_region(page, heapPageSize);
+#endif
+
+				// Slots are carved off the page on demand instead of touching the whole page up front
+				pool->pageCursor = page;
+				pool->pageEnd = add_ptr(page, heapPageSize);
+				pool->pageFresh = fresh;
+			}
+
+			addr = pool->pageCursor;
+			pool->pageCursor = add_ptr(addr, objectSize);
+#if HAS_ASAN
+			__asan_unpoison_memory_region(addr, alignedSize);
+#endif
+			if (zeroed && !pool->pageFresh)
+				memset(addr, 0, size);
+		}
+
+		++pool->allocationCount;
+		pool->requestedMemory += size;
+
+		return addr;
+	}
+
+}
+
+	void* virtual_alloc(usize size) {
+#ifdef _WIN32
+		return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_READWRITE);
+#else
+		auto result = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (result == MAP_FAILED)
+			return nullptr;
+
+		return result;
+#endif // _WIN32
+	}
+
+	bool virtual_try_grow(void *addr, [[maybe_unused]] usize size, usize newSize) {
+#ifdef _WIN32
+		auto result = VirtualAlloc(addr, newSize, MEM_RESERVE, PAGE_READWRITE);
+		if (result == nullptr)
+			return false;
+		if (result != addr) {
+			VirtualFree(result, 0, MEM_RELEASE);
+			return false;
+		}
+
+		return true;
+#else
+		auto nAddr = add_ptr(addr, size);
+		auto result = mmap(nAddr, newSize - size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (result == MAP_FAILED)
+			return false;
+		if (result != nAddr) {
+			munmap(result, newSize - size);
+			return false;
+		}
+
+		return true;
+#endif // _WIN32
+	}
+
+	void virtual_free(void *addr, usize size) {
+#ifdef _WIN32
+		(void)size;
+		auto result = VirtualFree(addr, 0, MEM_RELEASE);
+		assert(result);
+#else
+		[[maybe_unused]] auto result = munmap(addr, size);
+		assert(result == 0);
+#endif // _WIN32
+	}
+
+	i32 commit_region(void *addr, usize size) {
+#ifdef _WIN32
+		auto result = VirtualAlloc(addr, size, MEM_COMMIT, PAGE_READWRITE);
+		if (result == nullptr)
+			return 1;
+#if HAS_ASAN
+		__asan_poison_memory_region(addr, size);
+#endif
+#else
+		if (mprotect(addr, size, PROT_READ|PROT_WRITE) == -1)
+			return 1;
+		ASAN_POISON_MEMORY_REGION(addr, size);
+#endif
+		atomic_fetch_add<MemoryOrder::RELAXED>(&_memoryBudget.committedMemory, _budget_size(size));
+		return 0;
+	}
+
+	i32 decommit_region(void *addr, usize size) {
+#ifdef _WIN32
+#if HAS_ASAN
+		__asan_unpoison_memory_region(addr, size);
+#endif
+		if (VirtualFree(addr, size, MEM_DECOMMIT) == 0)
+			return 1;
+#else
+		ASAN_UNPOISON_MEMORY_REGION(addr, size);
+		if (mprotect(addr, size, PROT_NONE) == -1)
+			return 1;
+		if (madvise(addr, size, MADV_DONTNEED) == -1)
+			return 1;
+#endif
+		atomic_fetch_add<MemoryOrder::RELAXED>(&_memoryBudget.committedMemory, -_budget_size(size));
+		return 0;
+	}
+
+	void memory_tag_track(u32 tag, i64 bytes) {
+		assert(tag < MEMORY_TAG_COUNT);
+
+		auto& pending = _threadTagPending.bytes[tag];
+		pending += bytes;
+		if (pending >= MemoryTagPending::FLUSH_BYTES || pending <= -MemoryTagPending::FLUSH_BYTES) {
+			_memory_tag_publish(tag, pending);
+			pending = 0;
+		}
+	}
+
+	void memory_tag_flush() {
+		_threadTagPending.flush();
+	}
+
+	void memory_tag_set_name(u32 tag, char const *name) {
+		assert(tag < MEMORY_TAG_COUNT);
+		atomic_set(&_memoryTags[tag].name, const_cast<char*>(name));
+	}
+
+	isize memory_tag_top(MemoryTagStats *stats, isize count) {
+		memory_tag_flush();
+
+		isize written = 0;
+		for (u32 i = 1; i < MEMORY_TAG_COUNT; ++i) {
+			MemoryTagStats tagStats;
+			tagStats.tag = i;
+			tagStats.name = static_cast<char const*>(atomic_load(&_memoryTags[i].name));
+			tagStats.currentBytes = atomic_load<MemoryOrder::RELAXED>(&_memoryTags[i].currentBytes);
+			tagStats.peakBytes = atomic_load<MemoryOrder::RELAXED>(&_memoryTags[i].peakBytes);
+			if (!tagStats.peakBytes && !tagStats.name)
+				continue;
+
+			// Insertion into the sorted output, the tag count is small
+			auto pos = written;
+			while (pos > 0 && stats[pos - 1].currentBytes < tagStats.currentBytes)
+				--pos;
+			if (pos >= count)
+				continue;
+			auto last = written < count ? written : count - 1;
+			for (auto j = last; j > pos; --j)
+				stats[j] = stats[j - 1];
+			stats[pos] = tagStats;
+			if (written < count)
+				++written;
+		}
+
+		return written;
+	}
+
+	usize memory_budget_committed() {
+		auto committed = atomic_load<MemoryOrder::RELAXED>(&_memoryBudget.committedMemory);
+		return committed > 0 ? static_cast<usize>(committed) : 0;
+	}
+
+	void memory_budget_set_limit(usize maxCommittedBytes) {
+		atomic_lock(&_memoryBudget.lock);
+		SCOPE_EXIT(atomic_unlock(&_memoryBudget.lock));
+
+		_memoryBudget.maxCommittedMemory = maxCommittedBytes;
+	}
+
+	i32 memory_budget_register_trim(MemoryTrimFn fn, void *userData) {
+		atomic_lock(&_memoryBudget.lock);
+		SCOPE_EXIT(atomic_unlock(&_memoryBudget.lock));
+
+		if (_memoryBudget.trimCount == sarray_count(_memoryBudget.trimFns))
+			return 1;
+
+		_memoryBudget.trimFns[_memoryBudget.trimCount] = fn;
+		_memoryBudget.trimUserData[_memoryBudget.trimCount] = userData;
+		++_memoryBudget.trimCount;
+
+		return 0;
+	}
+
+	void memory_budget_unregister_trim(MemoryTrimFn fn, void *userData) {
+		atomic_lock(&_memoryBudget.lock);
+		SCOPE_EXIT(atomic_unlock(&_memoryBudget.lock));
+
+		for (i32 i = 0; i < _memoryBudget.trimCount; ++i) {
+			if (_memoryBudget.trimFns[i] == fn && _memoryBudget.trimUserData[i] == userData) {
+				--_memoryBudget.trimCount;
+				_memoryBudget.trimFns[i] = _memoryBudget.trimFns[_memoryBudget.trimCount];
+				_memoryBudget.trimUserData[i] = _memoryBudget.trimUserData[_memoryBudget.trimCount];
+				return;
+			}
+		}
+	}
+
+	void memory_pressure_set_source(char const *path, f32 avg10Threshold) {
+		atomic_lock(&_memoryBudget.lock);
+		SCOPE_EXIT(atomic_unlock(&_memoryBudget.lock));
+
+		auto length = strlen(path);
+		if (length >= sizeof(_memoryBudget.pressurePath))
+			length = sizeof(_memoryBudget.pressurePath) - 1;
+		memcpy(_memoryBudget.pressurePath, path, length);
+		_memoryBudget.pressurePath[length] = 0;
+		_memoryBudget.pressureThreshold = avg10Threshold;
+	}
+
+	bool memory_pressure_poll() {
+#ifdef _WIN32
+		return false;
+#else
+		char path[sizeof(_memoryBudget.pressurePath)];
+		f32 threshold;
+		{
+			atomic_lock(&_memoryBudget.lock);
+			SCOPE_EXIT(atomic_unlock(&_memoryBudget.lock));
+			memcpy(path, _memoryBudget.pressurePath, sizeof(path));
+			threshold = _memoryBudget.pressureThreshold;
+		}
+
+		auto fd = open(path, O_RDONLY|O_CLOEXEC);
+		if (fd == -1)
+			return false;
+		SCOPE_EXIT(close(fd));
+
+		char buffer[512];
+		auto count = read(fd, buffer, sizeof(buffer) - 1);
+		if (count <= 0)
+			return false;
+		buffer[count] = 0;
+
+		// The first line of the pressure stall format is "some avg10=x.xx avg60=..."
+		auto some = strstr(buffer, "some avg10=");
+		if (!some)
+			return false;
+		return strtof(some + sizeof("some avg10=") - 1, nullptr) > threshold;
+#endif
+	}
+
+	bool memory_budget_poll() {
+		MemoryTrimFn trimFns[array_count(_memoryBudget.trimFns)];
+		void *trimUserData[array_count(_memoryBudget.trimUserData)];
+		i32 trimCount;
+		usize maxCommittedMemory;
+		{
+			atomic_lock(&_memoryBudget.lock);
+			SCOPE_EXIT(atomic_unlock(&_memoryBudget.lock));
+			trimCount = _memoryBudget.trimCount;
+			memcpy(trimFns, _memoryBudget.trimFns, sizeof(trimFns));
+			memcpy(trimUserData, _memoryBudget.trimUserData, sizeof(trimUserData));
+			maxCommittedMemory = _memoryBudget.maxCommittedMemory;
+		}
+
+		auto overBudget = maxCommittedMemory && memory_budget_committed() > maxCommittedMemory;
+		if (!overBudget && !memory_pressure_poll())
+			return false;
+
+		// Callbacks run without the budget lock so they are free to register, unregister or trim
+		memory_arena_cache_purge();
+		for (i32 i = 0; i < trimCount; ++i)
+			trimFns[i](trimUserData[i]);
+
+		return true;
+	}
+
+	i32 memory_arena_init(MemoryArena **arena, usize size) {
+		usize pageSize;
+		usize commitSize;
+		void *addr;
+		if (auto cached = _arena_cache_take(size); cached) {
+			addr = cached;
+			pageSize = cached->pageSize;
+			commitSize = cached->commitSize;
+#if HAS_ASAN
+			__asan_poison_memory_region(add_ptr(addr, sizeof(MemoryArenaHeader)), commitSize - sizeof(MemoryArenaHeader));
+#endif
+		} else {
+			addr = _virtual_alloc_with_header(size, sizeof(MemoryArenaHeader), &pageSize);
+			if (!addr)
+				return 1;
+			commitSize = pageSize;
+		}
+
+		auto header = static_cast<MemoryArenaHeader*>(addr);
+		header->capacity = size;
+		header->usedMemory = sizeof(MemoryArenaHeader);
+		header->commitSize = commitSize;
+		header->pageSize = pageSize;
+		header->next = nullptr;
+		header->last = nullptr;
+		header->alignSize = 1;
+		header->flags = 0;
+
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+
+		header->_lock = 0;
+		header->_nextArena = nullptr;
+		header->_threadId = 0;
+		header->_epoch = 0;
+
+		*arena = static_cast<MemoryArena*>(addr);
+
+		return 0;
+	}
+
+	i32 memory_arena_init(MemoryArena **arena, void *addr, usize size) {
+		if (size < sizeof(MemoryArenaHeader))
+			return 1;
+
+		// Allocate the header
+		auto header = static_cast<MemoryArenaHeader*>(addr);
+		header->capacity = size;
+		header->usedMemory = sizeof(MemoryArenaHeader);
+		header->commitSize = size;
+		header->pageSize = _get_page_size();
+		header->next = nullptr;
+		header->last = nullptr;
+		header->alignSize = 1;
+		header->flags = MemoryArenaHeader::SUB_ALLOCATED_BIT;
+
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+
+		header->_lock = 0;
+		header->_nextArena = nullptr;
+		header->_threadId = 0;
+		header->_epoch = 0;
+
+#if HAS_ASAN
+		__asan_poison_memory_region(add_ptr(addr, sizeof(MemoryArenaHeader)), size - sizeof(MemoryArenaHeader));
+#endif
+
+		*arena = static_cast<MemoryArena*>(addr);
+
+		return 0;
+	}
+
+	void memory_arena_align_size(MemoryArena *arena, usize alignSize) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		header->alignSize = alignSize;
+	}
+
+	void memory_arena_destroy(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		if (header->flags & MemoryArenaHeader::SUB_ALLOCATED_BIT) {
+			// The arena no longer manages the memory region referenced by addr
+#if HAS_ASAN
+			__asan_unpoison_memory_region(header, header->capacity);
+#endif
+		} else if (header->flags & MemoryArenaHeader::CHECKPOINTED_BIT) {
+#ifndef _WIN32
+			auto fd = _memory_checkpoint_header(header)->fd;
+			auto capacity = header->capacity;
+			munmap(header, capacity);
+			close(fd);
+			_budget_track(-_budget_size(capacity));
+#endif
+		} else if (header->flags & MemoryArenaHeader::FILE_BACKED_BIT) {
+#ifndef _WIN32
+			auto fd = _memory_file_header(header)->fd;
+			auto commitSize = header->commitSize;
+			munmap(header, header->capacity);
+			close(fd);
+			_budget_track(-_budget_size(commitSize));
+#endif
+		} else if (header->flags & MemoryArenaHeader::SHARED_BIT) {
+			// Other processes may still map the memory so it is only unmapped, never cached
+#ifndef _WIN32
+			auto capacity = header->capacity;
+			munmap(header, capacity);
+			_budget_track(-_budget_size(capacity));
+#endif
+		} else if (!_arena_cache_put(header)) {
+			_arena_cache_release(header);
+		}
+	}
+
+	void memory_arena_cache_set_limit(usize maxCachedBytes) {
+		MemoryArenaHeader *victims;
+		{
+			atomic_lock(&_arenaCache.lock);
+			SCOPE_EXIT(atomic_unlock(&_arenaCache.lock));
+
+			_arenaCache.maxCachedBytes = maxCachedBytes;
+			victims = _arena_cache_trim(maxCachedBytes);
+		}
+		_arena_cache_release_list(victims);
+	}
+
+	void memory_arena_cache_purge() {
+		MemoryArenaHeader *victims;
+		{
+			atomic_lock(&_arenaCache.lock);
+			SCOPE_EXIT(atomic_unlock(&_arenaCache.lock));
+
+			victims = _arena_cache_trim(0);
+		}
+		_arena_cache_release_list(victims);
+	}
+
+	void* memory_arena_alloc(MemoryArena *arena, usize size, usize alignment) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+
+		auto threadOwned = header->flags & MemoryArenaHeader::THREAD_OWNED_BIT;
+		assert((!threadOwned || _memory_arena_is_owner(header)) && "thread owned arena used by another thread");
+		if (!threadOwned)
+			atomic_lock(&header->_lock);
+		SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&header->_lock););
+
+		assert(alignment <= header->pageSize);
+		assert(header->alignSize > 0);
+
+		auto offset = align(header->usedMemory, alignment);
+		auto alignedSize = align(size, header->alignSize);
+		if (offset + alignedSize > header->capacity)
+			return nullptr;
+
+		if (_memory_arena_ensure_commit_size(header, offset + alignedSize) != 0)
+			return nullptr;
+
+		header->usedMemory = offset + alignedSize + ASAN_RED_ZONE_SIZE;
+		header->allocationCount += 1;
+		header->requestedMemory += size;
+
+#if HAS_ASAN
+		__asan_unpoison_memory_region(add_ptr(header, offset), size);
+#endif
+
+		return add_ptr(header, offset);
+	}
+
+	void memory_arena_free(MemoryArena *arena, void *addr, usize size) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+
+		auto threadOwned = header->flags & MemoryArenaHeader::THREAD_OWNED_BIT;
+		assert((!threadOwned || _memory_arena_is_owner(header)) && "thread owned arena used by another thread");
+		if (!threadOwned)
+			atomic_lock(&header->_lock);
+		SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&header->_lock););
+
+		assert(header->alignSize > 0);
+
+		auto alignedSize = align(size, header->alignSize);
+		if (add_ptr(header, header->usedMemory - (alignedSize + ASAN_RED_ZONE_SIZE)) == addr)
+			header->usedMemory -= alignedSize + ASAN_RED_ZONE_SIZE;
+
+		header->requestedMemory -= size;
+		header->allocationCount -= 1;
+
+#if HAS_ASAN
+		__asan_poison_memory_region(addr, size);
+#endif
+	}
+
+	void* memory_arena_realloc(MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment) {
+		if (!addr)
+			return memory_arena_alloc(arena, newSize, alignment);
+
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+
+		{
+			auto threadOwned = header->flags & MemoryArenaHeader::THREAD_OWNED_BIT;
+			assert((!threadOwned || _memory_arena_is_owner(header)) && "thread owned arena used by another thread");
+			if (!threadOwned)
+				atomic_lock(&header->_lock);
+			SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&header->_lock););
+
+			assert(header->alignSize > 0);
+
+			auto alignedSize = align(size, header->alignSize);
+			auto offset = header->usedMemory - (alignedSize + ASAN_RED_ZONE_SIZE);
+			if (add_ptr(header, offset) == addr) {
+				if (offset + newSize > header->capacity)
+					return nullptr;
+
+				if (_memory_arena_ensure_commit_size(header, offset + newSize) != 0)
+					return nullptr;
+
+				header->usedMemory = offset + newSize + ASAN_RED_ZONE_SIZE;
+				header->requestedMemory += newSize - size;
+
+#if HAS_ASAN
+				__asan_unpoison_memory_region(add_ptr(header, offset), newSize);
+#endif
+
+				return add_ptr(header, offset);
+			}
+		}
+
+		auto nAddr = memory_arena_alloc(arena, newSize, alignment);
+		if (!nAddr)
+			return nullptr;
+		memcpy(nAddr, addr, size);
+		memory_arena_free(arena, addr, size);
+
+		return nAddr;
+	}
+
+	void memory_arena_clear(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto threadOwned = header->flags & MemoryArenaHeader::THREAD_OWNED_BIT;
+		assert((!threadOwned || _memory_arena_is_owner(header)) && "thread owned arena used by another thread");
+		if (!threadOwned)
+			atomic_lock(&header->_lock);
+		SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&header->_lock););
+
+		auto baseSize = _memory_arena_base_size(header);
+
+#if HAS_ASAN
+		__asan_poison_memory_region(add_ptr(header, baseSize), header->usedMemory - baseSize);
+#endif
+
+		header->usedMemory = baseSize;
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+	}
+
+	void memory_arena_trim(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+
+		// These arenas are either committed up front or not backed by commit_region
+		constexpr u32 fixedCommitBits = MemoryArenaHeader::SUB_ALLOCATED_BIT
+			| MemoryArenaHeader::MIRRORED_BIT
+			| MemoryArenaHeader::SHARED_BIT
+			| MemoryArenaHeader::CHECKPOINTED_BIT
+			| MemoryArenaHeader::FILE_BACKED_BIT;
+		if (header->flags & fixedCommitBits)
+			return;
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		auto nCommitSize = align(header->usedMemory, header->pageSize);
+		if (nCommitSize < header->commitSize
+				&& decommit_region(add_ptr(header, nCommitSize), header->commitSize - nCommitSize) == 0)
+			header->commitSize = nCommitSize;
+	}
+
+	bool memory_arena_is_owner(MemoryArena *arena) {
+		return _memory_arena_is_owner(bit_cast<MemoryArenaHeader*>(arena));
+	}
+
+	MemoryArenaMarker memory_arena_get_marker(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto threadOwned = header->flags & MemoryArenaHeader::THREAD_OWNED_BIT;
+		assert((!threadOwned || _memory_arena_is_owner(header)) && "thread owned arena used by another thread");
+		if (!threadOwned)
+			atomic_lock(&header->_lock);
+		SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&header->_lock););
+
+		return { header->usedMemory, header->allocationCount, header->requestedMemory };
+	}
+
+	void memory_arena_reset_to_marker(MemoryArena *arena, MemoryArenaMarker marker) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto threadOwned = header->flags & MemoryArenaHeader::THREAD_OWNED_BIT;
+		assert((!threadOwned || _memory_arena_is_owner(header)) && "thread owned arena used by another thread");
+		if (!threadOwned)
+			atomic_lock(&header->_lock);
+		SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&header->_lock););
+
+		assert(marker.usedMemory >= _memory_arena_base_size(header));
+		assert(marker.usedMemory <= header->usedMemory && "arena reset to a marker past its end");
+
+#if HAS_ASAN
+		__asan_poison_memory_region(
+				add_ptr(header, marker.usedMemory),
+				header->usedMemory - marker.usedMemory);
+#endif
+
+		header->usedMemory = marker.usedMemory;
+		header->allocationCount = marker.allocationCount;
+		header->requestedMemory = marker.requestedMemory;
+	}
+
+	i32 memory_arena_init_shared(
+			[[maybe_unused]] MemoryArena **arena,
+			[[maybe_unused]] i32 *fd_,
+			[[maybe_unused]] usize size,
+			[[maybe_unused]] char const *name) {
+#ifdef _WIN32
+		return 1;
+#else
+		auto pageSize = _get_page_size();
+		size = align(size, pageSize);
+		if (size < sizeof(MemoryArenaHeader) + sizeof(MemorySharedHeader))
+			return 1;
+
+		i32 fd = -1;
+		if (name) {
+			fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+		} else {
+#ifdef __linux__
+			fd = memfd_create("oak_shared_arena", MFD_CLOEXEC);
+#endif
+		}
+		if (fd == -1)
+			return 1;
+
+		auto addr = MAP_FAILED;
+		if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+			addr = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		if (addr == MAP_FAILED) {
+			close(fd);
+			if (name)
+				shm_unlink(name);
+			return 1;
+		}
+
+		auto header = static_cast<MemoryArenaHeader*>(addr);
+		header->capacity = size;
+		header->usedMemory = sizeof(MemoryArenaHeader) + sizeof(MemorySharedHeader);
+		header->commitSize = size;
+		header->pageSize = pageSize;
+		header->next = nullptr;
+		header->last = nullptr;
+		header->alignSize = 1;
+		header->flags = MemoryArenaHeader::SHARED_BIT;
+
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+
+		header->_lock = 0;
+		header->_nextArena = nullptr;
+		header->_threadId = 0;
+		header->_epoch = 0;
+
+		auto sharedHeader = static_cast<MemorySharedHeader*>(add_ptr(addr, sizeof(MemoryArenaHeader)));
+		sharedHeader->mappedSize = size;
+		// Publish the arena, everything written above is visible to a process that observes the magic
+		atomic_set(&sharedHeader->magic, MemorySharedHeader::MAGIC);
+		_budget_track(_budget_size(size));
+
+#if HAS_ASAN
+		__asan_poison_memory_region(add_ptr(addr, header->usedMemory), size - header->usedMemory);
+#endif
+
+		*fd_ = fd;
+		*arena = static_cast<MemoryArena*>(addr);
+
+		return 0;
+#endif
+	}
+
+	i32 memory_arena_attach_shared([[maybe_unused]] MemoryArena **arena, [[maybe_unused]] i32 fd) {
+#ifdef _WIN32
+		return 1;
+#else
+		// The creator sizes the file before publishing it, a smaller file is not ready to attach yet
+		struct stat st;
+		if (fstat(fd, &st) == -1 || static_cast<usize>(st.st_size) < sizeof(MemoryArenaHeader) + sizeof(MemorySharedHeader))
+			return 1;
+
+		auto size = static_cast<usize>(st.st_size);
+		auto addr = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		if (addr == MAP_FAILED)
+			return 1;
+
+		auto header = static_cast<MemoryArenaHeader*>(addr);
+		auto sharedHeader = static_cast<MemorySharedHeader*>(add_ptr(addr, sizeof(MemoryArenaHeader)));
+		if (atomic_load(&sharedHeader->magic) != MemorySharedHeader::MAGIC
+				|| sharedHeader->mappedSize != size
+				|| header->capacity != size
+				|| !(header->flags & MemoryArenaHeader::SHARED_BIT)) {
+			munmap(addr, size);
+			return 1;
+		}
+
+		_budget_track(_budget_size(size));
+		*arena = static_cast<MemoryArena*>(addr);
+
+		return 0;
+#endif
+	}
+
+	i32 memory_arena_attach_shared([[maybe_unused]] MemoryArena **arena, [[maybe_unused]] char const *name) {
+#ifdef _WIN32
+		return 1;
+#else
+		auto fd = shm_open(name, O_RDWR, 0600);
+		if (fd == -1)
+			return 1;
+		// The mapping stays valid once the descriptor is closed
+		auto result = memory_arena_attach_shared(arena, fd);
+		close(fd);
+		return result;
+#endif
+	}
+
+	i32 memory_arena_init_checkpointed([[maybe_unused]] MemoryArena **arena, [[maybe_unused]] usize size) {
+#ifndef __linux__
+		return 1;
+#else
+		auto pageSize = _get_page_size();
+		size = align(size, pageSize);
+		static_assert(sizeof(MemoryArenaHeader) + sizeof(MemoryCheckpointHeader) <= 4096);
+		if (size <= pageSize)
+			return 1;
+
+		auto fd = memfd_create("oak_checkpoint_arena", MFD_CLOEXEC);
+		if (fd == -1)
+			return 1;
+
+		auto addr = MAP_FAILED;
+		if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+			addr = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		if (addr == MAP_FAILED) {
+			close(fd);
+			return 1;
+		}
+
+		auto header = static_cast<MemoryArenaHeader*>(addr);
+		header->capacity = size;
+		header->usedMemory = pageSize;
+		header->commitSize = size;
+		header->pageSize = pageSize;
+		header->next = nullptr;
+		header->last = nullptr;
+		header->alignSize = 1;
+		header->flags = MemoryArenaHeader::CHECKPOINTED_BIT;
+
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+
+		header->_lock = 0;
+		header->_nextArena = nullptr;
+		header->_threadId = 0;
+		header->_epoch = 0;
+
+		auto checkpointHeader = _memory_checkpoint_header(header);
+		checkpointHeader->fd = fd;
+		checkpointHeader->active = false;
+		_budget_track(_budget_size(size));
+
+#if HAS_ASAN
+		__asan_poison_memory_region(add_ptr(addr, header->usedMemory), size - header->usedMemory);
+#endif
+
+		*arena = static_cast<MemoryArena*>(addr);
+
+		return 0;
+#endif
+	}
+
+	// Only the pages after the header page are remapped. The lock word and checkpoint state have to stay in
+	// the same page, futex waiters are keyed by the page and would never be woken if it changed under them.
+	i32 memory_arena_checkpoint([[maybe_unused]] MemoryArena *arena) {
+#ifndef __linux__
+		return 1;
+#else
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		assert(header->flags & MemoryArenaHeader::CHECKPOINTED_BIT);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		auto checkpointHeader = _memory_checkpoint_header(header);
+		auto pageSize = header->pageSize;
+		if (!checkpointHeader->active) {
+			if (mmap(
+						add_ptr(header, pageSize),
+						header->capacity - pageSize,
+						PROT_READ|PROT_WRITE,
+						MAP_PRIVATE|MAP_FIXED,
+						checkpointHeader->fd,
+						static_cast<off_t>(pageSize)) == MAP_FAILED)
+				return 1;
+			checkpointHeader->active = true;
+		} else {
+			// Move the checkpoint forward by folding the private pages into the memfd
+			if (_memory_checkpoint_flush(header, checkpointHeader->fd) != 0)
+				return 1;
+			if (madvise(add_ptr(header, pageSize), header->capacity - pageSize, MADV_DONTNEED) == -1)
+				return 1;
+		}
+
+		checkpointHeader->marker = { header->usedMemory, header->allocationCount, header->requestedMemory };
+		checkpointHeader->alignSize = header->alignSize;
+
+#if HAS_ASAN
+		__asan_poison_memory_region(add_ptr(header, header->usedMemory), header->capacity - header->usedMemory);
+#endif
+
+		return 0;
+#endif
+	}
+
+	i32 memory_arena_restore([[maybe_unused]] MemoryArena *arena) {
+#ifndef __linux__
+		return 1;
+#else
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		assert(header->flags & MemoryArenaHeader::CHECKPOINTED_BIT);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		auto checkpointHeader = _memory_checkpoint_header(header);
+		if (!checkpointHeader->active)
+			return 1;
+
+		auto pageSize = header->pageSize;
+		if (madvise(add_ptr(header, pageSize), header->capacity - pageSize, MADV_DONTNEED) == -1)
+			return 1;
+
+		header->usedMemory = checkpointHeader->marker.usedMemory;
+		header->allocationCount = checkpointHeader->marker.allocationCount;
+		header->requestedMemory = checkpointHeader->marker.requestedMemory;
+		header->alignSize = checkpointHeader->alignSize;
+
+#if HAS_ASAN
+		__asan_unpoison_memory_region(add_ptr(header, pageSize), header->usedMemory - pageSize);
+		__asan_poison_memory_region(add_ptr(header, header->usedMemory), header->capacity - header->usedMemory);
+#endif
+
+		return 0;
+#endif
+	}
+
+	i32 memory_arena_drop_checkpoint([[maybe_unused]] MemoryArena *arena) {
+#ifndef __linux__
+		return 1;
+#else
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		assert(header->flags & MemoryArenaHeader::CHECKPOINTED_BIT);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		auto checkpointHeader = _memory_checkpoint_header(header);
+		if (!checkpointHeader->active)
+			return 0;
+
+		if (_memory_checkpoint_flush(header, checkpointHeader->fd) != 0)
+			return 1;
+		auto pageSize = header->pageSize;
+		if (mmap(
+					add_ptr(header, pageSize),
+					header->capacity - pageSize,
+					PROT_READ|PROT_WRITE,
+					MAP_SHARED|MAP_FIXED,
+					checkpointHeader->fd,
+					static_cast<off_t>(pageSize)) == MAP_FAILED)
+			return 1;
+		checkpointHeader->active = false;
+
+#if HAS_ASAN
+		__asan_poison_memory_region(add_ptr(header, header->usedMemory), header->capacity - header->usedMemory);
+#endif
+
+		return 0;
+#endif
+	}
+
+	i32 memory_arena_open_file(
+			[[maybe_unused]] MemoryArena **arena,
+			[[maybe_unused]] char const *path,
+			[[maybe_unused]] usize size,
+			[[maybe_unused]] void *baseAddress,
+			[[maybe_unused]] bool *relocated) {
+#ifdef _WIN32
+		return 1;
+#else
+		auto pageSize = _get_page_size();
+		auto headerSize = sizeof(MemoryArenaHeader) + sizeof(MemoryFileHeader);
+
+		auto fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+		if (fd == -1)
+			return 1;
+
+		struct stat st;
+		if (fstat(fd, &st) == -1) {
+			close(fd);
+			return 1;
+		}
+
+		struct {
+			MemoryArenaHeader arena;
+			MemoryFileHeader file;
+		} stored;
+		auto fileSize = static_cast<usize>(st.st_size);
+		auto existing = fileSize != 0;
+		if (existing) {
+			// Refuse anything that isn't an arena file rather than overwrite it
+			if (fileSize < headerSize
+					|| pread(fd, &stored, sizeof(stored), 0) != static_cast<ssize_t>(sizeof(stored))
+					|| stored.file.magic != MemoryFileHeader::MAGIC
+					|| stored.arena.pageSize != pageSize
+					|| stored.arena.commitSize > fileSize
+					|| stored.arena.commitSize > stored.arena.capacity) {
+				close(fd);
+				return 1;
+			}
+		}
+
+		auto capacity = existing ? stored.arena.capacity : align(size, pageSize);
+		auto commitSize = existing ? stored.arena.commitSize : pageSize;
+		auto hint = existing ? stored.file.baseAddress : baseAddress;
+		if (capacity < headerSize) {
+			close(fd);
+			return 1;
+		}
+
+		auto addr = mmap(hint, capacity, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+		if (addr == MAP_FAILED) {
+			close(fd);
+			return 1;
+		}
+
+		if ((!existing && ftruncate(fd, static_cast<off_t>(commitSize)) == -1)
+				|| mmap(addr, commitSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED) {
+			munmap(addr, capacity);
+			close(fd);
+			return 1;
+		}
+
+		auto header = static_cast<MemoryArenaHeader*>(addr);
+		auto fileHeader = _memory_file_header(header);
+		if (!existing) {
+			header->capacity = capacity;
+			header->usedMemory = headerSize;
+			header->commitSize = commitSize;
+			header->pageSize = pageSize;
+			header->next = nullptr;
+			header->last = nullptr;
+			header->alignSize = 1;
+			header->flags = MemoryArenaHeader::FILE_BACKED_BIT;
+
+			header->allocationCount = 0;
+			header->requestedMemory = 0;
+
+			fileHeader->magic = MemoryFileHeader::MAGIC;
+		}
+
+		// Process local state left over from the last process to map the file
+		header->_lock = 0;
+		header->_nextArena = nullptr;
+		header->_threadId = 0;
+		header->_epoch = 0;
+		fileHeader->baseAddress = addr;
+		fileHeader->fd = fd;
+		_budget_track(_budget_size(commitSize));
+
+#if HAS_ASAN
+		__asan_poison_memory_region(add_ptr(addr, header->usedMemory), commitSize - header->usedMemory);
+#endif
+
+		if (relocated)
+			*relocated = existing && addr != hint;
+		*arena = static_cast<MemoryArena*>(addr);
+
+		return 0;
+#endif
+	}
+
+	i32 memory_arena_sync([[maybe_unused]] MemoryArena *arena) {
+#ifdef _WIN32
+		return 1;
+#else
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		assert(header->flags & MemoryArenaHeader::FILE_BACKED_BIT);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		if (msync(header, header->commitSize, MS_SYNC) == -1)
+			return 1;
+		return 0;
+#endif
+	}
+
+	i32 memory_pool_init(MemoryArena **arena, usize size, usize objectSize) {
+		usize pageSize;
+		auto addr = _virtual_alloc_with_header(
+				size, sizeof(MemoryArenaHeader) + sizeof(MemoryPoolHeader), &pageSize);
+
+		if (!addr)
+			return 1;
+
+		// Allocate pool header
+		auto header = static_cast<MemoryArenaHeader*>(addr);
+		auto poolHeader = static_cast<MemoryPoolHeader*>(add_ptr(addr, sizeof(MemoryArenaHeader)));
+		header->capacity = size;
+		header->usedMemory = sizeof(MemoryArenaHeader) + sizeof(MemoryPoolHeader);
+		header->commitSize = pageSize;
+		header->pageSize = pageSize;
+		header->alignSize = 1;
+		header->flags = 0;
+
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+
+		header->_lock = 0;
+		header->_nextArena = nullptr;
+		header->_threadId = 0;
+		header->_epoch = 0;
+
+		poolHeader->objectSize = align(objectSize, sizeof(void*));
+		poolHeader->freeList = nullptr;
+		poolHeader->remoteFreeList = nullptr;
+
+		*arena = static_cast<MemoryArena*>(addr);
+
+		return 0;
+	}
+
+	void memory_pool_destroy(MemoryArena *arena) {
+		// Threads can still push remote frees into a destroyed pool, keep its reservation out of the arena cache
+		_arena_cache_release(bit_cast<MemoryArenaHeader*>(arena));
+	}
+
+	void* memory_pool_alloc(MemoryArena *arena, usize size, usize alignment) {
+		size = align(size, sizeof(void*));
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto poolHeader = static_cast<MemoryPoolHeader*>(add_ptr(header, sizeof(MemoryArenaHeader)));
+
+		usize objectSize = poolHeader->objectSize;
+		assert(size <= objectSize);
+
+		{
+			auto threadOwned = header->flags & MemoryArenaHeader::THREAD_OWNED_BIT;
+			assert((!threadOwned || _memory_arena_is_owner(header)) && "thread owned pool allocated from by another thread");
+			if (!threadOwned)
+				atomic_lock(&header->_lock);
+			SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&header->_lock););
+
+			if (!poolHeader->freeList && threadOwned && atomic_load(&poolHeader->remoteFreeList)) {
+				poolHeader->freeList = atomic_exchange<MemoryOrder::ACQUIRE>(&poolHeader->remoteFreeList, nullptr);
+#if HAS_ASAN
+				for (auto it = poolHeader->freeList; it;) {
+					auto next = *static_cast<void**>(it);
+					__asan_poison_memory_region(it, sizeof(void*));
+					it = next;
+				}
+#endif
+			}
+
+			if (poolHeader->freeList) {
+				auto addr = poolHeader->freeList;
+#if HAS_ASAN
+				__asan_unpoison_memory_region(addr, size);
+#endif
+				poolHeader->freeList = *static_cast<void**>(addr);
+				return addr;
+			}
+		}
+
+		return memory_arena_alloc(arena, objectSize, alignment);
+	}
+
+	void memory_pool_free(MemoryArena *arena, void *addr, usize size) {
+		size = align(size, sizeof(void*));
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto poolHeader = static_cast<MemoryPoolHeader*>(add_ptr(header, sizeof(MemoryArenaHeader)));
+
+		auto threadOwned = header->flags & MemoryArenaHeader::THREAD_OWNED_BIT;
+		if (threadOwned && !_memory_arena_is_owner(header)) {
+#if HAS_ASAN
+			__asan_poison_memory_region(add_ptr(addr, sizeof(void*)), size - sizeof(void*));
+#endif
+			_remote_free_push(&poolHeader->remoteFreeList, addr);
+			return;
+		}
+
+		if (!threadOwned)
+			atomic_lock(&header->_lock);
+		SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&header->_lock););
+
+		*static_cast<void**>(addr) = poolHeader->freeList;
+		poolHeader->freeList = addr;
+
+#if HAS_ASAN
+		__asan_poison_memory_region(addr, size);
+#endif
+	}
+
+	void* memory_pool_realloc(MemoryArena*, void *addr, [[maybe_unused]] usize size, [[maybe_unused]] usize newSize, usize) {
+		assert(size == newSize);
+		return addr;
+	}
+
+	void memory_pool_clear(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto poolHeader = static_cast<MemoryPoolHeader*>(add_ptr(header, sizeof(MemoryArenaHeader)));
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		header->usedMemory = sizeof(MemoryArenaHeader) + sizeof(MemoryPoolHeader);
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+
+		poolHeader->freeList = nullptr;
+		poolHeader->remoteFreeList = nullptr;
+
+#if HAS_ASAN
+		__asan_poison_memory_region(
+				add_ptr(header, sizeof(MemoryArenaHeader) + sizeof(MemoryPoolHeader)),
+				header->capacity - sizeof(MemoryArenaHeader) - sizeof(MemoryPoolHeader));
+#endif
+	}
+
+	usize memory_pool_get_object_size(MemoryArena *arena) {
+		auto poolHeader = static_cast<MemoryPoolHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
+		return poolHeader->objectSize;
+	}
+
+	i32 memory_stack_init(MemoryArena **arena, void *addr, usize size, Allocator *fallback) {
+		if (size < sizeof(MemoryArenaHeader) + sizeof(MemoryStackHeader))
+			return 1;
+
+		if (memory_arena_init(arena, addr, size) != 0)
+			return 1;
+
+		auto header = static_cast<MemoryArenaHeader*>(addr);
+		auto stackHeader = static_cast<MemoryStackHeader*>(add_ptr(addr, sizeof(MemoryArenaHeader)));
+#if HAS_ASAN
+		__asan_unpoison_memory_region(stackHeader, sizeof(MemoryStackHeader));
+#endif
+		header->usedMemory = sizeof(MemoryArenaHeader) + sizeof(MemoryStackHeader);
+
+		stackHeader->fallback = fallback;
+		stackHeader->spillList = nullptr;
+
+		return 0;
+	}
+
+	void memory_stack_destroy(MemoryArena *arena) {
+		memory_stack_clear(arena);
+		memory_arena_destroy(arena);
+	}
+
+	void* memory_stack_alloc(MemoryArena *arena, usize size, usize alignment) {
+		if (auto addr = memory_arena_alloc(arena, size, alignment); addr)
+			return addr;
+
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto stackHeader = _memory_stack_header(arena);
+		if (!stackHeader->fallback)
+			return nullptr;
+
+		// Spilled blocks keep their bookkeeping directly in front of the returned address
+		if (alignment < alignof(MemoryStackSpill))
+			alignment = alignof(MemoryStackSpill);
+		auto offset = align(sizeof(MemoryStackSpill), alignment);
+		auto base = stackHeader->fallback->allocate(offset + size, alignment);
+		if (!base)
+			return nullptr;
+
+		auto addr = add_ptr(base, offset);
+		auto spill = _memory_stack_spill_of(addr);
+		spill->size = offset + size;
+		spill->offset = offset;
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		spill->prev = nullptr;
+		spill->next = static_cast<MemoryStackSpill*>(stackHeader->spillList);
+		if (spill->next)
+			spill->next->prev = spill;
+		stackHeader->spillList = spill;
+
+		return addr;
+	}
+
+	void memory_stack_free(MemoryArena *arena, void *addr, usize size) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		if (_memory_stack_owns(header, addr)) {
+			memory_arena_free(arena, addr, size);
+			return;
+		}
+
+		auto stackHeader = _memory_stack_header(arena);
+		auto spill = _memory_stack_spill_of(addr);
+
+		{
+			atomic_lock(&header->_lock);
+			SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+			if (spill->prev)
+				spill->prev->next = spill->next;
+			else
+				stackHeader->spillList = spill->next;
+			if (spill->next)
+				spill->next->prev = spill->prev;
+		}
+
+		stackHeader->fallback->deallocate(sub_ptr(addr, spill->offset), spill->size);
+	}
+
+	void* memory_stack_realloc(MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment) {
+		if (!addr)
+			return memory_stack_alloc(arena, newSize, alignment);
+
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		if (_memory_stack_owns(header, addr)) {
+			if (auto nAddr = memory_arena_realloc(arena, addr, size, newSize, alignment); nAddr)
+				return nAddr;
+		}
+
+		auto nAddr = memory_stack_alloc(arena, newSize, alignment);
+		if (!nAddr)
+			return nullptr;
+
+		memcpy(nAddr, addr, size <= newSize ? size : newSize);
+		memory_stack_free(arena, addr, size);
+
+		return nAddr;
+	}
+
+	void memory_stack_clear(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto stackHeader = _memory_stack_header(arena);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		auto spill = static_cast<MemoryStackSpill*>(stackHeader->spillList);
+		while (spill) {
+			auto next = spill->next;
+			auto addr = add_ptr(spill, sizeof(MemoryStackSpill));
+			stackHeader->fallback->deallocate(sub_ptr(addr, spill->offset), spill->size);
+			spill = next;
+		}
+		stackHeader->spillList = nullptr;
+
+#if HAS_ASAN
+		__asan_poison_memory_region(
+				add_ptr(header, sizeof(MemoryArenaHeader) + sizeof(MemoryStackHeader)),
+				header->usedMemory - sizeof(MemoryArenaHeader) - sizeof(MemoryStackHeader));
+#endif
+
+		header->usedMemory = sizeof(MemoryArenaHeader) + sizeof(MemoryStackHeader);
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+	}
+
+	i32 memory_ring_init(MemoryArena **arena, usize size, bool mirrored) {
+		auto pageSize = _get_page_size();
+		auto headerSize = align(sizeof(MemoryArenaHeader) + sizeof(MemoryRingHeader), pageSize);
+		auto ringSize = align(size, pageSize);
+		auto capacity = headerSize + (mirrored ? 2*ringSize : ringSize);
+
+		auto addr = _virtual_alloc_with_header(
+				capacity, sizeof(MemoryArenaHeader) + sizeof(MemoryRingHeader), nullptr);
+		if (!addr)
+			return 1;
+
+		auto ring = add_ptr(addr, headerSize);
+		if (mirrored) {
+#ifdef __linux__
+			auto fd = memfd_create("oak_ring", MFD_CLOEXEC);
+			if (fd == -1) {
+				virtual_free(addr, capacity);
+				return 1;
+			}
+			SCOPE_EXIT(close(fd));
+
+			if (ftruncate(fd, static_cast<off_t>(ringSize)) == -1
+					|| mmap(ring, ringSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED
+					|| mmap(add_ptr(ring, ringSize), ringSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED) {
+				virtual_free(addr, capacity);
+				return 1;
+			}
+			// Both views share the same pages
+			_budget_track(_budget_size(ringSize));
+#else
+			virtual_free(addr, capacity);
+			return 1;
+#endif
+		}
+
+		auto header = static_cast<MemoryArenaHeader*>(addr);
+		auto ringHeader = static_cast<MemoryRingHeader*>(add_ptr(addr, sizeof(MemoryArenaHeader)));
+		header->capacity = capacity;
+		header->usedMemory = headerSize;
+		header->commitSize = mirrored ? capacity : pageSize;
+		header->pageSize = pageSize;
+		header->next = nullptr;
+		header->last = nullptr;
+		header->alignSize = 1;
+		header->flags = 0;
+		if (mirrored)
+			header->flags |= MemoryArenaHeader::MIRRORED_BIT;
+
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+
+		header->_lock = 0;
+		header->_nextArena = nullptr;
+		header->_threadId = 0;
+		header->_epoch = 0;
+
+		ringHeader->head = 0;
+		ringHeader->tail = 0;
+		ringHeader->lastAllocation = 0;
+		ringHeader->ringSize = ringSize;
+		ringHeader->ring = ring;
+
+		*arena = static_cast<MemoryArena*>(addr);
+
+		return 0;
+	}
+
+	void memory_ring_destroy(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto capacity = header->capacity;
+		// The mirrored ring itself is mapped from a memfd, only its header page was committed
+		if (header->flags & MemoryArenaHeader::MIRRORED_BIT) {
+			_budget_track(-_budget_size(_memory_ring_header(arena)->ringSize));
+			decommit_region(header, header->pageSize);
+		} else
+			decommit_region(header, header->commitSize);
+		virtual_free(header, capacity);
+	}
+
+	void* memory_ring_alloc(MemoryArena *arena, usize size, usize alignment) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto ringHeader = _memory_ring_header(arena);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		assert(alignment <= header->pageSize);
+
+		auto pos = _memory_ring_place(header, ringHeader, align(ringHeader->head, alignment), size);
+		if (pos == ~u64{ 0 })
+			return nullptr;
+
+		ringHeader->lastAllocation = pos;
+		ringHeader->head = pos + size;
+		header->usedMemory = ptr_diff(ringHeader->ring, header) + (ringHeader->head - ringHeader->tail);
+		header->allocationCount += 1;
+		header->requestedMemory += size;
+
+		auto addr = add_ptr(ringHeader->ring, pos % ringHeader->ringSize);
+#if HAS_ASAN
+		__asan_unpoison_memory_region(addr, size);
+#endif
+
+		return addr;
+	}
+
+	void memory_ring_free(MemoryArena *arena, void *addr, usize size) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto ringHeader = _memory_ring_header(arena);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		// Only the most recent allocation can be given back, everything else waits for its fence
+		auto last = ringHeader->lastAllocation;
+		if (add_ptr(ringHeader->ring, last % ringHeader->ringSize) == addr
+				&& last + size == ringHeader->head && last >= ringHeader->tail) {
+			_memory_ring_poison(ringHeader, last, ringHeader->head);
+			ringHeader->head = last;
+			header->usedMemory = ptr_diff(ringHeader->ring, header) + (ringHeader->head - ringHeader->tail);
+		}
+
+		header->requestedMemory -= size;
+		header->allocationCount -= 1;
+	}
+
+	void* memory_ring_realloc(MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment) {
+		if (!addr)
+			return memory_ring_alloc(arena, newSize, alignment);
+
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto ringHeader = _memory_ring_header(arena);
+
+		{
+			atomic_lock(&header->_lock);
+			SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+			auto last = ringHeader->lastAllocation;
+			if (add_ptr(ringHeader->ring, last % ringHeader->ringSize) == addr
+					&& last + size == ringHeader->head && last >= ringHeader->tail) {
+				if (_memory_ring_place(header, ringHeader, last, newSize) == last) {
+					if (newSize < size)
+						_memory_ring_poison(ringHeader, last + newSize, ringHeader->head);
+					ringHeader->head = last + newSize;
+					header->usedMemory = ptr_diff(ringHeader->ring, header) + (ringHeader->head - ringHeader->tail);
+					header->requestedMemory += newSize - size;
+#if HAS_ASAN
+					__asan_unpoison_memory_region(addr, newSize);
+#endif
+					return addr;
+				}
+			}
+		}
+
+		auto nAddr = memory_ring_alloc(arena, newSize, alignment);
+		if (!nAddr)
+			return nullptr;
+		memcpy(nAddr, addr, size <= newSize ? size : newSize);
+		memory_ring_free(arena, addr, size);
+
+		return nAddr;
+	}
+
+	void memory_ring_clear(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto ringHeader = _memory_ring_header(arena);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		_memory_ring_poison(ringHeader, ringHeader->tail, ringHeader->head);
+		ringHeader->tail = ringHeader->head;
+		header->usedMemory = ptr_diff(ringHeader->ring, header);
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+	}
+
+	u64 memory_ring_fence(MemoryArena *arena) {
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto ringHeader = _memory_ring_header(arena);
 
 		atomic_lock(&header->_lock);
 		SCOPE_EXIT(atomic_unlock(&header->_lock));
 
-		header->alignSize = alignSize;
+		return ringHeader->head;
 	}
 
-	void memory_arena_destroy(MemoryArena *arena) {
+	void memory_ring_release_until(MemoryArena *arena, u64 fence) {
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
-		if (header->flags & MemoryArenaHeader::SUB_ALLOCATED_BIT) {
-			// The arena no longer manages the memory region referenced by addr
+		auto ringHeader = _memory_ring_header(arena);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		assert(fence <= ringHeader->head && "ring fence is newer than the ring head");
+		if (fence <= ringHeader->tail)
+			return;
+
+		_memory_ring_poison(ringHeader, ringHeader->tail, fence);
+		ringHeader->tail = fence;
+		header->usedMemory = ptr_diff(ringHeader->ring, header) + (ringHeader->head - ringHeader->tail);
+	}
+
+	i32 memory_buddy_init(MemoryArena **arena, usize size, usize minBlockSize) {
+		assert(is_pow2(minBlockSize));
+
+		auto pageSize = _get_page_size();
+		if (minBlockSize < pageSize)
+			minBlockSize = pageSize;
+		if (size < minBlockSize)
+			return 1;
+
+		// The block region is the largest power of two multiple of the minimum block that fits in size
+		auto leafCount = usize{ 1 } << blog2(size / minBlockSize);
+		auto maxOrder = static_cast<i32>(blog2(leafCount));
+		auto treeOffset = align(sizeof(MemoryArenaHeader) + sizeof(MemoryBuddyHeader), alignof(u64));
+		auto bitsOffset = align(treeOffset + 2*leafCount - 1, alignof(u64));
+		auto metaSize = align(bitsOffset + align(leafCount, 64)/8, pageSize);
+		// Reserve enough slack to start the block region on a multiple of its size, every block is then
+		// aligned to its own size
+		auto regionSize = leafCount*minBlockSize;
+		auto capacity = metaSize + 2*regionSize - pageSize;
+
+		auto addr = _virtual_alloc_with_header(
+				capacity, sizeof(MemoryArenaHeader) + sizeof(MemoryBuddyHeader), nullptr);
+		if (!addr)
+			return 1;
+
+		if (metaSize > pageSize && commit_region(add_ptr(addr, pageSize), metaSize - pageSize) != 0) {
+			virtual_free(addr, capacity);
+			return 1;
+		}
 #if HAS_ASAN
-			__asan_unpoison_memory_region(header, header->capacity);
+		__asan_unpoison_memory_region(addr, metaSize);
 #endif
-		} else {
-			auto capacity = header->capacity;
-			decommit_region(header, header->commitSize);
-			virtual_free(header, capacity);
+
+		auto header = static_cast<MemoryArenaHeader*>(addr);
+		auto buddyHeader = static_cast<MemoryBuddyHeader*>(add_ptr(addr, sizeof(MemoryArenaHeader)));
+		header->capacity = capacity;
+		header->usedMemory = metaSize;
+		header->commitSize = metaSize;
+		header->pageSize = pageSize;
+		header->next = nullptr;
+		header->last = nullptr;
+		header->alignSize = 1;
+		header->flags = 0;
+
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+
+		header->_lock = 0;
+		header->_nextArena = nullptr;
+		header->_threadId = 0;
+		header->_epoch = 0;
+
+		buddyHeader->minBlockSize = minBlockSize;
+		buddyHeader->maxOrder = maxOrder;
+		buddyHeader->orderTree = static_cast<u8*>(add_ptr(addr, treeOffset));
+		buddyHeader->commitBits = static_cast<u64*>(add_ptr(addr, bitsOffset));
+		buddyHeader->metaSize = metaSize;
+		buddyHeader->blocks = align(add_ptr(addr, metaSize), regionSize);
+
+		_memory_buddy_reset_tree(buddyHeader);
+		memset(buddyHeader->commitBits, 0, align(leafCount, 64)/8);
+
+		*arena = static_cast<MemoryArena*>(addr);
+
+		return 0;
+	}
+
+	void memory_buddy_destroy(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto buddyHeader = _memory_buddy_header(arena);
+		auto capacity = header->capacity;
+
+		// Only the committed runs of blocks are decommitted so the memory budget stays balanced
+		auto bits = buddyHeader->commitBits;
+		auto leafCount = isize{ 1 } << buddyHeader->maxOrder;
+		isize i = 0;
+		while (i < leafCount) {
+			if (!(bits[i >> 6] & (u64{ 1 } << (i & 63)))) {
+				++i;
+				continue;
+			}
+
+			auto start = i;
+			while (i < leafCount && (bits[i >> 6] & (u64{ 1 } << (i & 63))))
+				++i;
+
+			decommit_region(
+					add_ptr(buddyHeader->blocks, start*buddyHeader->minBlockSize),
+					(i - start)*buddyHeader->minBlockSize);
 		}
+		decommit_region(header, buddyHeader->metaSize);
+		virtual_free(header, capacity);
 	}
 
-	void* memory_arena_alloc(MemoryArena *arena, usize size, usize alignment) {
+	void* memory_buddy_alloc(MemoryArena *arena, usize size, [[maybe_unused]] usize alignment) {
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto buddyHeader = _memory_buddy_header(arena);
+
+		auto order = _memory_buddy_order(buddyHeader, size);
+		if (order > buddyHeader->maxOrder)
+			return nullptr;
+		// Blocks are aligned to their size, the order is derived from the size again on free so it can't be
+		// raised to satisfy a larger alignment
+		assert(alignment <= (buddyHeader->minBlockSize << order) && "buddy alignment larger than the block size");
 
 		atomic_lock(&header->_lock);
 		SCOPE_EXIT(atomic_unlock(&header->_lock));
 
-		assert(alignment <= header->pageSize);
-		assert(header->alignSize > 0);
-
-		auto offset = align(header->usedMemory, alignment);
-		auto alignedSize = align(size, header->alignSize);
-		if (offset + alignedSize > header->capacity)
+		auto tree = buddyHeader->orderTree;
+		if (tree[0] < order + 1)
 			return nullptr;
 
-		if (_memory_arena_ensure_commit_size(header, offset + alignedSize) != 0)
+		// Descend towards a subtree that still has a free block of the requested order
+		isize idx = 0;
+		for (auto nodeOrder = buddyHeader->maxOrder; nodeOrder > order; --nodeOrder) {
+			idx = 2*idx + 1;
+			if (tree[idx] < order + 1)
+				++idx;
+		}
+
+		auto blockIdx = idx - _memory_buddy_level_start(buddyHeader, order);
+		auto leafCount = isize{ 1 } << order;
+		if (_memory_buddy_commit(header, buddyHeader, blockIdx*leafCount, leafCount) != 0)
 			return nullptr;
 
-		header->usedMemory = offset + alignedSize + ASAN_RED_ZONE_SIZE;
+		tree[idx] = 0;
+		while (idx > 0) {
+			idx = (idx - 1)/2;
+			auto left = tree[2*idx + 1], right = tree[2*idx + 2];
+			tree[idx] = left > right ? left : right;
+		}
+
+		auto blockSize = buddyHeader->minBlockSize << order;
+		header->usedMemory += blockSize;
 		header->allocationCount += 1;
 		header->requestedMemory += size;
 
+		auto addr = add_ptr(buddyHeader->blocks, blockIdx*blockSize);
 #if HAS_ASAN
-		__asan_unpoison_memory_region(add_ptr(header, offset), size);
+		__asan_unpoison_memory_region(addr, size);
 #endif
 
-		return add_ptr(header, offset);
+		return addr;
 	}
 
-	void memory_arena_free(MemoryArena *arena, void *addr, usize size) {
+	void memory_buddy_free(MemoryArena *arena, void *addr, usize size) {
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto buddyHeader = _memory_buddy_header(arena);
+
+		auto order = _memory_buddy_order(buddyHeader, size);
+		auto blockSize = buddyHeader->minBlockSize << order;
+		auto offset = ptr_diff(addr, buddyHeader->blocks);
+		assert(offset >= 0 && offset % blockSize == 0 && "address isn't a block of this buddy allocator");
 
 		atomic_lock(&header->_lock);
 		SCOPE_EXIT(atomic_unlock(&header->_lock));
 
-		assert(header->alignSize > 0);
-
-		auto alignedSize = align(size, header->alignSize);
-		if (add_ptr(header, header->usedMemory - (alignedSize + ASAN_RED_ZONE_SIZE)) == addr)
-			header->usedMemory -= alignedSize + ASAN_RED_ZONE_SIZE;
+		auto tree = buddyHeader->orderTree;
+		isize idx = _memory_buddy_level_start(buddyHeader, order) + offset/blockSize;
+		assert(tree[idx] == 0 && "double free of buddy block");
+		tree[idx] = static_cast<u8>(order + 1);
+
+		// Coalesce with the buddy whenever both halves of a parent are free again
+		for (auto nodeOrder = order + 1; idx > 0; ++nodeOrder) {
+			idx = (idx - 1)/2;
+			auto left = tree[2*idx + 1], right = tree[2*idx + 2];
+			if (left == nodeOrder && right == nodeOrder)
+				tree[idx] = static_cast<u8>(nodeOrder + 1);
+			else
+				tree[idx] = left > right ? left : right;
+		}
 
-		header->requestedMemory -= size;
+		header->usedMemory -= blockSize;
 		header->allocationCount -= 1;
+		header->requestedMemory -= size;
 
 #if HAS_ASAN
 		__asan_poison_memory_region(addr, size);
 #endif
 	}
 
-	void* memory_arena_realloc(MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment) {
+	void* memory_buddy_realloc(MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment) {
 		if (!addr)
-			return memory_arena_alloc(arena, newSize, alignment);
+			return memory_buddy_alloc(arena, newSize, alignment);
 
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
-
-		{
+		auto buddyHeader = _memory_buddy_header(arena);
+		if (_memory_buddy_order(buddyHeader, size) == _memory_buddy_order(buddyHeader, newSize)) {
 			atomic_lock(&header->_lock);
 			SCOPE_EXIT(atomic_unlock(&header->_lock));
+#if HAS_ASAN
+			__asan_unpoison_memory_region(addr, newSize);
+#endif
+			header->requestedMemory += newSize - size;
+			return addr;
+		}
 
-			assert(header->alignSize > 0);
+		auto nAddr = memory_buddy_alloc(arena, newSize, alignment);
+		if (!nAddr)
+			return nullptr;
+		memcpy(nAddr, addr, size <= newSize ? size : newSize);
+		memory_buddy_free(arena, addr, size);
 
-			auto alignedSize = align(size, header->alignSize);
-			auto offset = header->usedMemory - (alignedSize + ASAN_RED_ZONE_SIZE);
-			if (add_ptr(header, offset) == addr) {
-				if (offset + newSize > header->capacity)
-					return nullptr;
+		return nAddr;
+	}
 
-				if (_memory_arena_ensure_commit_size(header, offset + newSize) != 0)
-					return nullptr;
+	void memory_buddy_clear(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto buddyHeader = _memory_buddy_header(arena);
 
-				header->usedMemory = offset + newSize + ASAN_RED_ZONE_SIZE;
-				header->requestedMemory += newSize - size;
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		_memory_buddy_reset_tree(buddyHeader);
+
+		header->usedMemory = buddyHeader->metaSize;
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
 
 #if HAS_ASAN
-				__asan_unpoison_memory_region(add_ptr(header, offset), newSize);
+		__asan_poison_memory_region(buddyHeader->blocks, buddyHeader->minBlockSize << buddyHeader->maxOrder);
 #endif
+	}
 
-				return add_ptr(header, offset);
+	i32 memory_tlsf_init(MemoryArena **arena, usize size) {
+		auto pageSize = _get_page_size();
+		auto blocksOffset = align(sizeof(MemoryArenaHeader) + sizeof(MemoryTlsfHeader), TLSF_ALIGN);
+		auto capacity = align(size, pageSize);
+		if (capacity < blocksOffset + 2*TLSF_HEADER_SIZE + TLSF_MIN_PAYLOAD)
+			return 1;
+
+		auto addr = virtual_alloc(capacity);
+		if (!addr)
+			return 1;
+
+		if (commit_region(addr, capacity) != 0) {
+			virtual_free(addr, capacity);
+			return 1;
+		}
+		_prefault_region(addr, capacity, pageSize);
+#if HAS_ASAN
+		__asan_unpoison_memory_region(addr, blocksOffset);
+#endif
+
+		auto header = static_cast<MemoryArenaHeader*>(addr);
+		auto tlsfHeader = static_cast<MemoryTlsfHeader*>(add_ptr(addr, sizeof(MemoryArenaHeader)));
+		header->capacity = capacity;
+		header->usedMemory = blocksOffset;
+		header->commitSize = capacity;
+		header->pageSize = pageSize;
+		header->next = nullptr;
+		header->last = nullptr;
+		header->alignSize = 1;
+		header->flags = 0;
+
+		header->allocationCount = 0;
+		header->requestedMemory = 0;
+
+		header->_lock = 0;
+		header->_nextArena = nullptr;
+		header->_threadId = 0;
+		header->_epoch = 0;
+
+		tlsfHeader->blocks = add_ptr(addr, blocksOffset);
+		_tlsf_reset(header, tlsfHeader);
+
+		*arena = static_cast<MemoryArena*>(addr);
+
+		return 0;
+	}
+
+	void memory_tlsf_destroy(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto capacity = header->capacity;
+		decommit_region(header, capacity);
+		virtual_free(header, capacity);
+	}
+
+	void* memory_tlsf_alloc(MemoryArena *arena, usize size, usize alignment) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto tlsfHeader = _memory_tlsf_header(arena);
+
+		assert(alignment <= header->pageSize);
+
+		auto alignedSize = align(size ? size : 1, TLSF_ALIGN);
+		// Over aligned requests reserve enough room to split a free block off the front
+		auto searchSize = alignedSize;
+		if (alignment > TLSF_ALIGN)
+			searchSize += alignment + TLSF_HEADER_SIZE + TLSF_MIN_PAYLOAD;
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		auto block = _tlsf_find(tlsfHeader, searchSize);
+		if (!block)
+			return nullptr;
+		_tlsf_remove(tlsfHeader, block);
+
+		if (auto payload = _tlsf_payload(block); alignment > TLSF_ALIGN && align_offset(payload, alignment) != 0) {
+			auto aligned = align(add_ptr(payload, TLSF_HEADER_SIZE + TLSF_MIN_PAYLOAD), alignment);
+			auto gap = static_cast<usize>(ptr_diff(aligned, payload));
+			auto alignedBlock = _tlsf_make_block(sub_ptr(aligned, TLSF_HEADER_SIZE));
+			alignedBlock->size = (_tlsf_size(block) - gap) | TlsfBlock::FREE_BIT | TlsfBlock::PREV_FREE_BIT;
+			alignedBlock->prevPhys = block;
+			_tlsf_next_phys(alignedBlock)->prevPhys = alignedBlock;
+
+			block->size = (gap - TLSF_HEADER_SIZE) | (block->size & TLSF_FLAG_MASK);
+			_tlsf_insert(tlsfHeader, block);
+			block = alignedBlock;
+		}
+
+		block->size &= ~usize{ TlsfBlock::FREE_BIT };
+		_tlsf_next_phys(block)->size &= ~usize{ TlsfBlock::PREV_FREE_BIT };
+		_tlsf_trim(tlsfHeader, block, alignedSize);
+
+		header->usedMemory += _tlsf_size(block) + TLSF_HEADER_SIZE;
+		header->allocationCount += 1;
+		header->requestedMemory += size;
+
+		auto addr = _tlsf_payload(block);
+#if HAS_ASAN
+		__asan_unpoison_memory_region(addr, size);
+#endif
+
+		return addr;
+	}
+
+	void memory_tlsf_free(MemoryArena *arena, void *addr, usize size) {
+		if (!addr)
+			return;
+
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto tlsfHeader = _memory_tlsf_header(arena);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		auto block = _tlsf_block_of(addr);
+		assert(!(block->size & TlsfBlock::FREE_BIT) && "double free of tlsf block");
+
+		header->usedMemory -= _tlsf_size(block) + TLSF_HEADER_SIZE;
+		header->allocationCount -= 1;
+		header->requestedMemory -= size;
+
+#if HAS_ASAN
+		__asan_poison_memory_region(add_ptr(addr, TLSF_MIN_PAYLOAD), _tlsf_size(block) - TLSF_MIN_PAYLOAD);
+		__asan_unpoison_memory_region(addr, TLSF_MIN_PAYLOAD);
+#endif
+
+		block->size |= TlsfBlock::FREE_BIT;
+
+		// Coalesce with the physical neighbours
+		if (block->size & TlsfBlock::PREV_FREE_BIT) {
+			auto prev = block->prevPhys;
+			_tlsf_remove(tlsfHeader, prev);
+			prev->size += _tlsf_size(block) + TLSF_HEADER_SIZE;
+			block = prev;
+		}
+
+		auto next = _tlsf_next_phys(block);
+		if (next->size & TlsfBlock::FREE_BIT) {
+			_tlsf_remove(tlsfHeader, next);
+			block->size += _tlsf_size(next) + TLSF_HEADER_SIZE;
+			next = _tlsf_next_phys(block);
+		}
+		next->prevPhys = block;
+		next->size |= TlsfBlock::PREV_FREE_BIT;
+
+		_tlsf_insert(tlsfHeader, block);
+	}
+
+	void* memory_tlsf_realloc(MemoryArena *arena, void *addr, usize size, usize newSize, usize alignment) {
+		if (!addr)
+			return memory_tlsf_alloc(arena, newSize, alignment);
+
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto tlsfHeader = _memory_tlsf_header(arena);
+		auto alignedSize = align(newSize ? newSize : 1, TLSF_ALIGN);
+
+		{
+			atomic_lock(&header->_lock);
+			SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+			auto block = _tlsf_block_of(addr);
+			auto next = _tlsf_next_phys(block);
+			auto available = _tlsf_size(block);
+			if (available < alignedSize && (next->size & TlsfBlock::FREE_BIT))
+				available += _tlsf_size(next) + TLSF_HEADER_SIZE;
+
+			if (available >= alignedSize) {
+				auto oldSize = _tlsf_size(block);
+				if (oldSize < alignedSize) {
+					// Grow into the free neighbour
+					_tlsf_remove(tlsfHeader, next);
+					block->size += _tlsf_size(next) + TLSF_HEADER_SIZE;
+					_tlsf_next_phys(block)->prevPhys = block;
+					_tlsf_next_phys(block)->size &= ~usize{ TlsfBlock::PREV_FREE_BIT };
+				}
+				_tlsf_trim(tlsfHeader, block, alignedSize);
+
+				header->usedMemory += _tlsf_size(block) - oldSize;
+				header->requestedMemory += newSize - size;
+#if HAS_ASAN
+				__asan_unpoison_memory_region(addr, newSize);
+#endif
+				return addr;
 			}
 		}
 
-		auto nAddr = memory_arena_alloc(arena, newSize, alignment);
+		auto nAddr = memory_tlsf_alloc(arena, newSize, alignment);
 		if (!nAddr)
 			return nullptr;
-		memcpy(nAddr, addr, size);
-		memory_arena_free(arena, addr, size);
+		memcpy(nAddr, addr, size <= newSize ? size : newSize);
+		memory_tlsf_free(arena, addr, size);
 
 		return nAddr;
 	}
 
-	void memory_arena_clear(MemoryArena *arena) {
+	void memory_tlsf_clear(MemoryArena *arena) {
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto tlsfHeader = _memory_tlsf_header(arena);
+
 		atomic_lock(&header->_lock);
 		SCOPE_EXIT(atomic_unlock(&header->_lock));
 
 #if HAS_ASAN
-		__asan_poison_memory_region(
-				add_ptr(header, sizeof(MemoryArenaHeader)),
-				header->usedMemory - sizeof(MemoryArenaHeader));
+		__asan_poison_memory_region(tlsfHeader->blocks, header->capacity - ptr_diff(tlsfHeader->blocks, header));
 #endif
+		_tlsf_reset(header, tlsfHeader);
 
-		header->usedMemory = sizeof(MemoryArenaHeader);
+		header->usedMemory = ptr_diff(tlsfHeader->blocks, header);
 		header->allocationCount = 0;
 		header->requestedMemory = 0;
 	}
 
-	i32 memory_pool_init(MemoryArena **arena, usize size, usize objectSize) {
-		usize pageSize;
-		auto addr = _virtual_alloc_with_header(
-				size, sizeof(MemoryArenaHeader) + sizeof(MemoryPoolHeader), &pageSize);
+	i32 memory_handle_init(MemoryArena **arena, usize size) {
+		auto pageSize = _get_page_size();
+		auto blocksCapacity = align(size, pageSize);
+		auto maxSlotCount = blocksCapacity / (2*HANDLE_ALIGN);
+		if (maxSlotCount > MemoryHandleHeader::INDEX_MASK + 1)
+			maxSlotCount = MemoryHandleHeader::INDEX_MASK + 1;
+		if (!maxSlotCount)
+			return 1;
+
+		auto slotsOffset = align(sizeof(MemoryArenaHeader) + sizeof(MemoryHandleHeader), alignof(MemoryHandleSlot));
+		auto blocksOffset = align(slotsOffset + maxSlotCount*sizeof(MemoryHandleSlot), pageSize);
+		auto capacity = blocksOffset + blocksCapacity;
 
+		auto addr = _virtual_alloc_with_header(capacity, slotsOffset, nullptr);
 		if (!addr)
 			return 1;
 
-		// Allocate pool header
 		auto header = static_cast<MemoryArenaHeader*>(addr);
-		auto poolHeader = static_cast<MemoryPoolHeader*>(add_ptr(addr, sizeof(MemoryArenaHeader)));
-		header->capacity = size;
-		header->usedMemory = sizeof(MemoryArenaHeader) + sizeof(MemoryPoolHeader);
+		auto handleHeader = static_cast<MemoryHandleHeader*>(add_ptr(addr, sizeof(MemoryArenaHeader)));
+		// The slot table is committed as it fills, commitSize only covers the headers and the table
+		header->capacity = capacity;
+		header->usedMemory = slotsOffset;
 		header->commitSize = pageSize;
 		header->pageSize = pageSize;
+		header->next = nullptr;
+		header->last = nullptr;
 		header->alignSize = 1;
 		header->flags = 0;
 
@@ -477,90 +2941,226 @@ namespace {
 		header->_lock = 0;
 		header->_nextArena = nullptr;
 		header->_threadId = 0;
+		header->_epoch = 0;
 
-		poolHeader->objectSize = align(objectSize, sizeof(void*));
-		poolHeader->freeList = nullptr;
+		*handleHeader = {};
+		handleHeader->slots = static_cast<MemoryHandleSlot*>(add_ptr(addr, slotsOffset));
+		handleHeader->maxSlotCount = static_cast<u32>(maxSlotCount);
+		handleHeader->blocks = add_ptr(addr, blocksOffset);
+		handleHeader->blocksCapacity = blocksCapacity;
 
 		*arena = static_cast<MemoryArena*>(addr);
 
 		return 0;
 	}
 
-	void memory_pool_destroy(MemoryArena *arena) {
-		memory_arena_destroy(arena);
+	void memory_handle_destroy(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto handleHeader = _memory_handle_header(arena);
+		auto capacity = header->capacity;
+		if (handleHeader->blocksCommitSize)
+			decommit_region(handleHeader->blocks, handleHeader->blocksCommitSize);
+		decommit_region(header, header->commitSize);
+		virtual_free(header, capacity);
 	}
 
-	void* memory_pool_alloc(MemoryArena *arena, usize size, usize alignment) {
-		size = align(size, sizeof(void*));
+	MemoryHandle memory_handle_alloc(MemoryArena *arena, usize size) {
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
-		auto poolHeader = static_cast<MemoryPoolHeader*>(add_ptr(header, sizeof(MemoryArenaHeader)));
+		auto handleHeader = _memory_handle_header(arena);
+		auto blockSize = align(sizeof(HandleBlock) + size, HANDLE_ALIGN);
 
-		usize objectSize = poolHeader->objectSize;
-		assert(size <= objectSize);
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
 
-		{
-			atomic_lock(&header->_lock);
-			SCOPE_EXIT(atomic_unlock(&header->_lock));
+		if (blockSize > handleHeader->blocksCapacity - handleHeader->top)
+			return 0;
 
-			if (poolHeader->freeList) {
-				auto addr = poolHeader->freeList;
-#if HAS_ASAN
-				__asan_unpoison_memory_region(addr, size);
-#endif
-				poolHeader->freeList = *static_cast<void**>(addr);
-				return addr;
+		u32 index;
+		if (handleHeader->freeSlot) {
+			index = handleHeader->freeSlot - 1;
+		} else {
+			if (handleHeader->slotCount == handleHeader->maxSlotCount)
+				return 0;
+			index = handleHeader->slotCount;
+			auto slotsEnd = static_cast<usize>(ptr_diff(handleHeader->slots + index + 1, header));
+			if (slotsEnd > header->commitSize) {
+				auto nCommitSize = align(slotsEnd, header->pageSize);
+				if (commit_region(add_ptr(header, header->commitSize), nCommitSize - header->commitSize) != 0)
+					return 0;
+				header->commitSize = nCommitSize;
 			}
+#if HAS_ASAN
+			__asan_unpoison_memory_region(handleHeader->slots + index, sizeof(MemoryHandleSlot));
+#endif
+			handleHeader->slots[index] = {};
+			++handleHeader->slotCount;
 		}
 
-		return memory_arena_alloc(arena, objectSize, alignment);
+		auto end = handleHeader->top + blockSize;
+		if (end > handleHeader->blocksCommitSize) {
+			auto nCommitSize = align(end, header->pageSize);
+			if (commit_region(
+						add_ptr(handleHeader->blocks, handleHeader->blocksCommitSize),
+						nCommitSize - handleHeader->blocksCommitSize) != 0)
+				return 0;
+			handleHeader->blocksCommitSize = nCommitSize;
+		}
+
+		auto& slot = handleHeader->slots[index];
+		if (handleHeader->freeSlot)
+			handleHeader->freeSlot = slot.nextFree;
+		if (!slot.generation)
+			slot.generation = 1;
+		slot.nextFree = 0;
+
+		_handle_unpoison(handleHeader, handleHeader->top, end);
+		auto block = _handle_block(handleHeader, handleHeader->top);
+		block->slot = index;
+		block->size = blockSize;
+		slot.ptr = block + 1;
+		handleHeader->top = end;
+
+		header->usedMemory += blockSize;
+		header->allocationCount += 1;
+		header->requestedMemory += size;
+
+		return (slot.generation << MemoryHandleHeader::INDEX_BITS) | index;
 	}
 
-	void memory_pool_free(MemoryArena *arena, void *addr, usize size) {
-		size = align(size, sizeof(void*));
+	void memory_handle_free(MemoryArena *arena, MemoryHandle handle) {
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
-		auto poolHeader = static_cast<MemoryPoolHeader*>(add_ptr(header, sizeof(MemoryArenaHeader)));
+		auto handleHeader = _memory_handle_header(arena);
 
 		atomic_lock(&header->_lock);
 		SCOPE_EXIT(atomic_unlock(&header->_lock));
 
-		*static_cast<void**>(addr) = poolHeader->freeList;
-		poolHeader->freeList = addr;
+		auto index = handle & MemoryHandleHeader::INDEX_MASK;
+		assert(index < handleHeader->slotCount);
+		auto& slot = handleHeader->slots[index];
+		assert(slot.ptr && slot.generation == handle >> MemoryHandleHeader::INDEX_BITS);
 
-#if HAS_ASAN
-		__asan_poison_memory_region(addr, size);
-#endif
-	}
+		auto block = static_cast<HandleBlock*>(sub_ptr(slot.ptr, sizeof(HandleBlock)));
+		auto offset = static_cast<usize>(ptr_diff(block, handleHeader->blocks));
+		auto blockSize = block->size;
 
-	void* memory_pool_realloc(MemoryArena*, void *addr, [[maybe_unused]] usize size, [[maybe_unused]] usize newSize, usize) {
-		assert(size == newSize);
-		return addr;
+		header->usedMemory -= blockSize;
+		header->allocationCount -= 1;
+		header->requestedMemory -= blockSize - sizeof(HandleBlock);
+
+		// Generations skip 0 so a handle is never 0
+		slot.ptr = nullptr;
+		slot.generation = (slot.generation & MemoryHandleHeader::GENERATION_MASK) % MemoryHandleHeader::GENERATION_MASK + 1;
+		slot.nextFree = handleHeader->freeSlot;
+		handleHeader->freeSlot = index + 1;
+
+		if (offset + blockSize == handleHeader->top) {
+			handleHeader->top = offset;
+			if (handleHeader->compactCursor > offset)
+				handleHeader->compactCursor = offset;
+			if (handleHeader->compactDest > offset)
+				handleHeader->compactDest = offset;
+		} else {
+			block->slot = HandleBlock::DEAD_SLOT;
+			handleHeader->deadMemory += blockSize;
+			// Keep the block header readable for the compaction scan
+			_handle_poison(handleHeader, offset + sizeof(HandleBlock), offset + blockSize);
+			return;
+		}
+		_handle_poison(handleHeader, offset, offset + blockSize);
 	}
 
-	void memory_pool_clear(MemoryArena *arena) {
+	void memory_handle_clear(MemoryArena *arena) {
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
-		auto poolHeader = static_cast<MemoryPoolHeader*>(add_ptr(header, sizeof(MemoryArenaHeader)));
+		auto handleHeader = _memory_handle_header(arena);
+
 		atomic_lock(&header->_lock);
 		SCOPE_EXIT(atomic_unlock(&header->_lock));
 
-		header->usedMemory = sizeof(MemoryArenaHeader) + sizeof(MemoryPoolHeader);
+		// Every live handle goes stale and the slots are chained back together in index order
+		handleHeader->freeSlot = 0;
+		for (auto i = handleHeader->slotCount; i > 0; --i) {
+			auto& slot = handleHeader->slots[i - 1];
+			if (slot.ptr) {
+				slot.ptr = nullptr;
+				slot.generation = (slot.generation & MemoryHandleHeader::GENERATION_MASK) % MemoryHandleHeader::GENERATION_MASK + 1;
+			}
+			slot.nextFree = handleHeader->freeSlot;
+			handleHeader->freeSlot = i;
+		}
+
+		_handle_poison(handleHeader, 0, handleHeader->top);
+		handleHeader->top = 0;
+		handleHeader->deadMemory = 0;
+		handleHeader->compactCursor = 0;
+		handleHeader->compactDest = 0;
+
+		header->usedMemory = ptr_diff(handleHeader->slots, header);
 		header->allocationCount = 0;
 		header->requestedMemory = 0;
+	}
 
-		poolHeader->freeList = nullptr;
+	bool memory_handle_compact(MemoryArena *arena, usize budget) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto handleHeader = _memory_handle_header(arena);
 
-#if HAS_ASAN
-		__asan_poison_memory_region(
-				add_ptr(header, sizeof(MemoryArenaHeader) + sizeof(MemoryPoolHeader)),
-				header->capacity - sizeof(MemoryArenaHeader) - sizeof(MemoryPoolHeader));
-#endif
-	}
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
 
-	usize memory_pool_get_object_size(MemoryArena *arena) {
-		auto poolHeader = static_cast<MemoryPoolHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
-		return poolHeader->objectSize;
+		// Nothing to move, only a pass that hasn't started yet can skip the scan
+		if (!handleHeader->deadMemory && handleHeader->compactCursor == 0
+				&& align(handleHeader->top, header->pageSize) == handleHeader->blocksCommitSize)
+			return true;
+
+		usize spent = 0;
+		auto cursor = handleHeader->compactCursor;
+		auto dest = handleHeader->compactDest;
+		while (cursor < handleHeader->top && spent < budget) {
+			auto block = _handle_block(handleHeader, cursor);
+			auto blockSize = block->size;
+			spent += HandleBlock::SCAN_COST;
+
+			if (block->slot == HandleBlock::DEAD_SLOT) {
+				handleHeader->deadMemory -= blockSize;
+				_handle_poison(handleHeader, cursor, cursor + sizeof(HandleBlock));
+				cursor += blockSize;
+				continue;
+			}
+
+			if (dest != cursor) {
+				auto nBlock = _handle_block(handleHeader, dest);
+				_handle_unpoison(handleHeader, dest, cursor);
+				memmove(nBlock, block, blockSize);
+				handleHeader->slots[nBlock->slot].ptr = nBlock + 1;
+				// Everything between the moved block and the next one is now part of the gap
+				_handle_poison(handleHeader, dest + blockSize, cursor + blockSize);
+				spent += blockSize;
+			}
+
+			dest += blockSize;
+			cursor += blockSize;
+		}
+
+		if (cursor < handleHeader->top) {
+			handleHeader->compactCursor = cursor;
+			handleHeader->compactDest = dest;
+			return false;
+		}
+
+		// Every live block sits below dest now, the pages past it can go
+		handleHeader->top = dest;
+		handleHeader->compactCursor = 0;
+		handleHeader->compactDest = 0;
+
+		auto nCommitSize = align(dest, header->pageSize);
+		if (nCommitSize < handleHeader->blocksCommitSize
+				&& decommit_region(
+					add_ptr(handleHeader->blocks, nCommitSize), handleHeader->blocksCommitSize - nCommitSize) == 0)
+			handleHeader->blocksCommitSize = nCommitSize;
+
+		return true;
 	}
 
-	i32 memory_heap_init(MemoryArena **arena, usize size) {
+	i32 memory_heap_init(MemoryArena **arena, usize size, usize maxSize) {
 		usize pageSize;
 		auto addr = _virtual_alloc_with_header(
 				size, sizeof(MemoryArenaHeader) + sizeof(MemoryHeapHeader), &pageSize);
@@ -571,7 +3171,7 @@ namespace {
 		// Initialize headers
 		auto header = static_cast<MemoryArenaHeader*>(addr);
 		auto heapHeader = static_cast<MemoryHeapHeader*>(add_ptr(addr, sizeof(MemoryArenaHeader)));
-		header->capacity = size;
+		header->capacity = align(size, pageSize);
 		header->usedMemory = sizeof(MemoryArenaHeader) + sizeof(MemoryHeapHeader);
 		header->commitSize = pageSize;
 		header->pageSize = pageSize;
@@ -586,82 +3186,46 @@ namespace {
 		header->_lock = 0;
 		header->_nextArena = nullptr;
 		header->_threadId = _get_thread_id();
+		header->_epoch = 0;
 
 		heapHeader->minPoolObjectSize = 1 << 5;
-		heapHeader->maxPoolObjectSize = 1 << (5 + sarray_count(heapHeader->poolFreeLists) - 1);
+		heapHeader->maxPoolObjectSize = 1 << (5 + sarray_count(heapHeader->pools) - 1);
 		heapHeader->heapSmallPageSize = 64 << 10;
 		heapHeader->heapLargePageSize = 2 << 20;
 
-		for (isize i = 0; i < sarray_count(heapHeader->poolFreeLists); ++i) {
-			heapHeader->poolFreeLists[i] = nullptr;
+		for (isize i = 0; i < sarray_count(heapHeader->pools); ++i) {
+			heapHeader->pools[i] = {};
+			heapHeader->remoteFreeLists[i] = nullptr;
 		}
+		heapHeader->freshOffset = 0;
+
+		heapHeader->maxSize = maxSize < header->capacity ? header->capacity : maxSize;
+		heapHeader->reservedSize = header->capacity;
+		heapHeader->segmentCount = 0;
+		heapHeader->activeSegment = 0;
 
 		*arena = static_cast<MemoryArena*>(addr);
 
 		return 0;
 	}
 
-	void* memory_heap_alloc(MemoryArena *arena, usize size, usize alignment) {
-		auto header = bit_cast<MemoryArenaHeader*>(arena);
+	void memory_heap_destroy(MemoryArena *arena) {
 		auto heapHeader = static_cast<MemoryHeapHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
-
-		assert(alignment <= header->pageSize);
-		assert(sizeof(void*) <= heapHeader->minPoolObjectSize);
-
-		usize objectSize;
-		isize poolIdx = _memory_heap_pool_idx(&objectSize, heapHeader, size, alignment);
-		assert(size <= objectSize);
-		assert(heapHeader->minPoolObjectSize <= objectSize && objectSize <= heapHeader->maxPoolObjectSize);
-
-		[[maybe_unused]] usize alignedSize = align(size, sizeof(void*));
-
-		atomic_lock(&header->_lock);
-		SCOPE_EXIT(atomic_unlock(&header->_lock));
-
-		if (poolIdx >= 0) {
-			assert(poolIdx < sarray_count(heapHeader->poolFreeLists));
-
-			void **freeList = heapHeader->poolFreeLists + poolIdx;
-
-			if (!*freeList) {
-				usize heapPageSize = heapHeader->heapSmallPageSize;
-				if (size > heapHeader->heapSmallPageSize >> 1)
-					heapPageSize = heapHeader->heapLargePageSize;
-				assert(heapPageSize == align(heapPageSize, header->pageSize));
-				void *addr = _memory_heap_alloc_pages(header, heapPageSize);
-				if (!addr)
-					return nullptr;
-
-				memset(addr, 0, heapPageSize);
-
-				// Build free list for page
-				assert(objectSize < heapPageSize);
-				isize slotCount = heapPageSize/objectSize;
-				assert(slotCount > 1);
-				for (isize i = 0; i < slotCount - 1; ++i) {
-					void *slot = add_ptr(addr, i*objectSize);
-					*static_cast<void**>(slot) = add_ptr(addr, (i + 1)*objectSize);
-				}
-				*static_cast<void**>(add_ptr(addr, (slotCount - 1)*objectSize)) = nullptr;
-				*freeList = addr;
-#if HAS_ASAN
-				__asan_poison_memory_region(addr, heapPageSize);
-#endif
-			}
-
-			void *addr = *freeList;
-			assert(addr && addr > arena && addr < add_ptr(arena, header->capacity));
-#if HAS_ASAN
-			__asan_unpoison_memory_region(addr, alignedSize);
-#endif
-			*freeList = *static_cast<void**>(addr);
-			++header->allocationCount;
-			header->requestedMemory += size;
-
-			return addr;
+		for (i32 i = 0; i < heapHeader->segmentCount; ++i) {
+			auto segment = heapHeader->segments + i;
+			decommit_region(segment->base, segment->commitSize);
+			virtual_free(segment->base, segment->capacity);
 		}
+		// Threads can still push remote frees into a destroyed heap, keep its reservation out of the arena cache
+		_arena_cache_release(bit_cast<MemoryArenaHeader*>(arena));
+	}
 
-		return nullptr;
+	void* memory_heap_alloc(MemoryArena *arena, usize size, usize alignment) {
+		return _memory_heap_alloc(arena, size, alignment, false);
+	}
+
+	void* memory_heap_alloc_zeroed(MemoryArena *arena, usize size, usize alignment) {
+		return _memory_heap_alloc(arena, size, alignment, true);
 	}
 
 	void memory_heap_free(MemoryArena *arena, void *addr, usize size) {
@@ -673,21 +3237,34 @@ namespace {
 
 		[[maybe_unused]] usize alignedSize = align(size, sizeof(void*));
 
-		atomic_lock(&header->_lock);
-		SCOPE_EXIT(atomic_unlock(&header->_lock));
+		auto threadOwned = header->flags & MemoryArenaHeader::THREAD_OWNED_BIT;
+		if (threadOwned && !_memory_arena_is_owner(header)) {
+			assert(poolIdx >= 0 && poolIdx < sarray_count(heapHeader->remoteFreeLists));
+			auto node = static_cast<HeapRemoteFree*>(addr);
+			node->size = size;
+#if HAS_ASAN
+			__asan_poison_memory_region(add_ptr(addr, sizeof(HeapRemoteFree)), alignedSize - sizeof(HeapRemoteFree));
+#endif
+			_remote_free_push(heapHeader->remoteFreeLists + poolIdx, addr);
+			return;
+		}
 
 		assert(poolIdx >= 0);
-		assert(addr > arena && addr < add_ptr(arena, header->capacity));
+		assert(_memory_heap_owns(header, heapHeader, addr));
 
 		if (poolIdx >= 0) {
-			assert(poolIdx < sarray_count(heapHeader->poolFreeLists));
-			void **freeList = heapHeader->poolFreeLists + poolIdx;
+			assert(poolIdx < sarray_count(heapHeader->pools));
+			auto pool = heapHeader->pools + poolIdx;
 
-			*static_cast<void**>(addr) = *freeList;
-			*freeList = addr;
+			if (!threadOwned)
+				atomic_lock(&pool->_lock);
+			SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&pool->_lock););
 
-			--header->allocationCount;
-			header->requestedMemory -= size;
+			*static_cast<void**>(addr) = pool->freeList;
+			pool->freeList = addr;
+
+			--pool->allocationCount;
+			pool->requestedMemory -= size;
 
 #if HAS_ASAN
 			__asan_poison_memory_region(addr, alignedSize);
@@ -718,12 +3295,17 @@ namespace {
 		[[maybe_unused]] usize nAlignedSize = align(newSize, sizeof(void*));
 		assert(newSize <= objectSize);
 		if (oldPoolIdx == newPoolIdx) {
-			atomic_lock(&header->_lock);
-			SCOPE_EXIT(atomic_unlock(&header->_lock));
+			auto threadOwned = header->flags & MemoryArenaHeader::THREAD_OWNED_BIT;
+			assert((!threadOwned || _memory_arena_is_owner(header)) && "thread owned heap reallocated from by another thread");
+			assert(newPoolIdx >= 0);
+			auto pool = heapHeader->pools + newPoolIdx;
+			if (!threadOwned)
+				atomic_lock(&pool->_lock);
+			SCOPE_EXIT_BLOCK(if (!threadOwned) atomic_unlock(&pool->_lock););
 #if HAS_ASAN
 			__asan_unpoison_memory_region(addr, nAlignedSize);
 #endif
-			header->requestedMemory += newSize - size;
+			pool->requestedMemory += newSize - size;
 			return addr;
 		} else {
 			auto nAddr = memory_heap_alloc(arena, newSize, alignment);
@@ -742,15 +3324,38 @@ namespace {
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
 		auto heapHeader = static_cast<MemoryHeapHeader*>(add_ptr(header, sizeof(MemoryArenaHeader)));
 
+		// Size class locks are always taken before the arena lock
+		for (auto& pool : heapHeader->pools)
+			atomic_lock(&pool._lock);
 		atomic_lock(&header->_lock);
-		SCOPE_EXIT(atomic_unlock(&header->_lock));
+		SCOPE_EXIT_BLOCK(
+			atomic_unlock(&header->_lock);
+			for (auto& pool : heapHeader->pools)
+				atomic_unlock(&pool._lock);
+		);
 
 		header->usedMemory = sizeof(MemoryArenaHeader) + sizeof(MemoryHeapHeader);
 		header->allocationCount = 0;
 		header->requestedMemory = 0;
 
-		for (isize i = 0; i < sarray_count(heapHeader->poolFreeLists); ++i) {
-			heapHeader->poolFreeLists[i] = nullptr;
+		for (isize i = 0; i < sarray_count(heapHeader->pools); ++i) {
+			auto pool = heapHeader->pools + i;
+			pool->freeList = nullptr;
+			pool->pageCursor = nullptr;
+			pool->pageEnd = nullptr;
+			pool->pageFresh = false;
+			pool->allocationCount = 0;
+			pool->requestedMemory = 0;
+			heapHeader->remoteFreeLists[i] = nullptr;
+		}
+
+		// Segments stay reserved and committed for reuse
+		heapHeader->activeSegment = 0;
+		for (i32 i = 0; i < heapHeader->segmentCount; ++i) {
+			heapHeader->segments[i].usedMemory = 0;
+#if HAS_ASAN
+			__asan_poison_memory_region(heapHeader->segments[i].base, heapHeader->segments[i].capacity);
+#endif
 		}
 
 #if HAS_ASAN
@@ -760,6 +3365,35 @@ namespace {
 #endif
 	}
 
+	void memory_heap_trim(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto heapHeader = static_cast<MemoryHeapHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
+
+		memory_arena_trim(arena);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		for (i32 i = 0; i < heapHeader->segmentCount; ++i) {
+			auto segment = heapHeader->segments + i;
+			auto nCommitSize = align(segment->usedMemory, header->pageSize);
+			if (nCommitSize < segment->commitSize
+					&& decommit_region(add_ptr(segment->base, nCommitSize), segment->commitSize - nCommitSize) == 0)
+				segment->commitSize = nCommitSize;
+		}
+	}
+
+	void memory_heap_get_stats(MemoryArena *arena, i64 *allocationCount, usize *requestedMemory) {
+		auto heapHeader = static_cast<MemoryHeapHeader*>(add_ptr(arena, sizeof(MemoryArenaHeader)));
+
+		*allocationCount = 0;
+		*requestedMemory = 0;
+		for (auto& pool : heapHeader->pools) {
+			*allocationCount += atomic_load<MemoryOrder::RELAXED>(&pool.allocationCount);
+			*requestedMemory += atomic_load<MemoryOrder::RELAXED>(&pool.requestedMemory);
+		}
+	}
+
 	i32 mt_memory_arena_init(MemoryArena **arena, usize size) {
 		usize pageSize;
 		auto addr = _virtual_alloc_with_header(
@@ -775,6 +3409,7 @@ namespace {
 		header->totalUsedMemory = 0;
 
 		header->_lock = 0;
+		header->epoch = 0;
 		header->first = nullptr;
 		header->last = nullptr;
 
@@ -789,11 +3424,15 @@ namespace {
 			atomic_lock(&header->_lock);
 			SCOPE_EXIT(atomic_unlock(&header->_lock));
 
+			// Other threads may still hold their arena in _threadLocalArena, releasing the reservations instead of
+			// caching them makes a stale use fault rather than allocate from memory handed to another arena
 			auto it = header->first;
 			while (it) {
-				auto localHeader = it;
-				it = bit_cast<MemoryArenaHeader*>(it)->_nextArena;
-				memory_arena_destroy(localHeader);
+				auto localHeader = bit_cast<MemoryArenaHeader*>(it);
+				it = localHeader->_nextArena;
+				if (_threadLocalArena == bit_cast<MemoryArena*>(localHeader))
+					_threadLocalArena = nullptr;
+				_arena_cache_release(localHeader);
 			}
 
 		}
@@ -807,7 +3446,17 @@ namespace {
 		auto localArena = _require_thread_local_arena(header);
 		if (!localArena)
 			return nullptr;
-		return memory_arena_alloc(localArena, size, alignment);
+
+		_mt_memory_arena_sync_epoch(header, localArena);
+
+		auto result = memory_arena_alloc(localArena, size, alignment);
+#ifndef NDEBUG
+		if (result) {
+			atomic_fetch_add<MemoryOrder::RELAXED>(&header->totalAllocationCount, u64{ 1 });
+			atomic_fetch_add<MemoryOrder::RELAXED>(&header->totalRequestedMemory, u64{ size });
+		}
+#endif
+		return result;
 	}
 
 	void mt_memory_arena_free(MemoryArena *arena, void *addr, usize size) {
@@ -816,6 +3465,12 @@ namespace {
 		if (!localArena)
 			return;
 		memory_arena_free(localArena, addr, size);
+#ifndef NDEBUG
+		if (addr) {
+			atomic_fetch_add<MemoryOrder::RELAXED>(&header->totalAllocationCount, ~u64{ 0 });
+			atomic_fetch_add<MemoryOrder::RELAXED>(&header->totalRequestedMemory, u64{ 0 } - size);
+		}
+#endif
 	}
 
 	void* mt_memory_arena_realloc(
@@ -824,6 +3479,7 @@ namespace {
 		auto localArena = _require_thread_local_arena(header);
 		if (!localArena)
 			return nullptr;
+		_mt_memory_arena_sync_epoch(header, localArena);
 		return memory_arena_realloc(localArena, addr, size, newSize, alignment);
 	}
 
@@ -832,19 +3488,41 @@ namespace {
 		auto localArena = _require_thread_local_arena(header);
 		if (!localArena)
 			return;
+		_mt_memory_arena_sync_epoch(header, localArena);
 		memory_arena_clear(localArena);
 	}
 
+	void mt_memory_arena_clear_all(MemoryArena *arena) {
+		auto header = bit_cast<MTMemoryArenaHeader*>(arena);
+
+		atomic_lock(&header->_lock);
+		SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+		auto epoch = atomic_load(&header->epoch);
+		for (auto it = header->first; it; it = bit_cast<MemoryArenaHeader*>(it)->_nextArena) {
+			memory_arena_clear(it);
+			bit_cast<MemoryArenaHeader*>(it)->_epoch = epoch;
+		}
+	}
+
+	u64 mt_memory_arena_next_epoch(MemoryArena *arena) {
+		auto header = bit_cast<MTMemoryArenaHeader*>(arena);
+		return atomic_fetch_add(&header->epoch, u64{ 1 }) + 1;
+	}
+
 	i32 sys_alloc_init(MemoryArena **arena) {
 		usize pageSize;
 		auto addr = _virtual_alloc_with_header(
-				sizeof(MemoryArenaHeader), sizeof(MemoryArenaHeader), &pageSize);
+				sizeof(MemoryArenaHeader) + sizeof(MemorySysHeader),
+				sizeof(MemoryArenaHeader) + sizeof(MemorySysHeader),
+				&pageSize);
 		if (!addr)
 			return 1;
 
 		auto header = static_cast<MemoryArenaHeader*>(addr);
+		auto sysHeader = static_cast<MemorySysHeader*>(add_ptr(addr, sizeof(MemoryArenaHeader)));
 		header->capacity = 0;
-		header->usedMemory = sizeof(MemoryArenaHeader);
+		header->usedMemory = sizeof(MemoryArenaHeader) + sizeof(MemorySysHeader);
 		header->commitSize = pageSize;
 		header->pageSize = pageSize;
 		header->next = nullptr;
@@ -857,6 +3535,13 @@ namespace {
 		header->_lock = 0;
 		header->_nextArena = nullptr;
 		header->_threadId = 0;
+		header->_epoch = 0;
+
+		sysHeader->retainedMemory = 0;
+		sysHeader->maxRetainedMemory = usize{ 64 } << 20;
+		for (isize i = 0; i < sarray_count(sysHeader->spanBuckets); ++i) {
+			sysHeader->spanBuckets[i] = nullptr;
+		}
 
 		*arena = static_cast<MemoryArena*>(addr);
 
@@ -867,6 +3552,8 @@ namespace {
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
 		auto pageSize = header->pageSize;
 
+		sys_alloc_purge(arena);
+
 		decommit_region(header, pageSize);
 		virtual_free(header, pageSize);
 	}
@@ -876,25 +3563,42 @@ namespace {
 			return nullptr;
 
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto sysHeader = _memory_sys_header(arena);
 		assert(alignment <= header->pageSize);
 		auto alignedSize = align(size, header->pageSize);
 		assert(alignedSize > 0);
 
-		auto addr = virtual_alloc(alignedSize);
-		if (!addr)
-			return nullptr;
-		if (commit_region(addr, alignedSize) != 0) {
-			virtual_free(addr, alignedSize);
-			return nullptr;
+		void *addr = nullptr;
+		{
+			atomic_lock(&header->_lock);
+			SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+			auto it = sysHeader->spanBuckets + _sys_span_bucket(header, sysHeader, alignedSize);
+			for (; *it; it = &static_cast<SysSpan*>(*it)->next) {
+				if (static_cast<SysSpan*>(*it)->size == alignedSize) {
+					addr = *it;
+					*it = static_cast<SysSpan*>(*it)->next;
+					sysHeader->retainedMemory -= alignedSize;
+					break;
+				}
+			}
+		}
+
+		if (!addr) {
+			addr = virtual_alloc(alignedSize);
+			if (!addr)
+				return nullptr;
+			if (commit_region(addr, alignedSize) != 0) {
+				virtual_free(addr, alignedSize);
+				return nullptr;
+			}
 		}
 
 #ifndef NDEBUG
-		atomic_lock(&header->_lock);
-		header->usedMemory += alignedSize;
-		header->commitSize += alignedSize;
-		header->requestedMemory += size;
-		++header->allocationCount;
-		atomic_unlock(&header->_lock);
+		atomic_fetch_add<MemoryOrder::RELAXED>(&header->usedMemory, alignedSize);
+		atomic_fetch_add<MemoryOrder::RELAXED>(&header->commitSize, alignedSize);
+		atomic_fetch_add<MemoryOrder::RELAXED>(&header->requestedMemory, size);
+		atomic_fetch_add<MemoryOrder::RELAXED>(&header->allocationCount, i64{ 1 });
 #endif
 
 #if HAS_ASAN
@@ -908,20 +3612,41 @@ namespace {
 			return;
 
 		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto sysHeader = _memory_sys_header(arena);
 		auto alignedSize = align(size, header->pageSize);
 
-		decommit_region(addr, alignedSize);
-		virtual_free(addr, alignedSize);
-
 #ifndef NDEBUG
-		atomic_lock(&header->_lock);
-		assert(size <= header->requestedMemory);
-		header->usedMemory -= alignedSize;
-		header->commitSize -= alignedSize;
-		header->requestedMemory -= size;
-		--header->allocationCount;
-		atomic_unlock(&header->_lock);
+		atomic_fetch_add<MemoryOrder::RELAXED>(&header->usedMemory, usize{ 0 } - alignedSize);
+		atomic_fetch_add<MemoryOrder::RELAXED>(&header->commitSize, usize{ 0 } - alignedSize);
+		[[maybe_unused]] auto requestedMemory = atomic_fetch_add<MemoryOrder::RELAXED>(
+				&header->requestedMemory, usize{ 0 } - size);
+		assert(size <= requestedMemory);
+		atomic_fetch_add<MemoryOrder::RELAXED>(&header->allocationCount, i64{ -1 });
+#endif
+
+		{
+			atomic_lock(&header->_lock);
+			SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+			if (sysHeader->retainedMemory + alignedSize <= sysHeader->maxRetainedMemory) {
+				_sys_span_release_lazily(addr, alignedSize);
+#if HAS_ASAN
+				__asan_poison_memory_region(addr, alignedSize);
+				__asan_unpoison_memory_region(addr, sizeof(SysSpan));
 #endif
+				// Writing the span link keeps its first page resident, the rest can be reclaimed
+				auto span = static_cast<SysSpan*>(addr);
+				auto bucket = sysHeader->spanBuckets + _sys_span_bucket(header, sysHeader, alignedSize);
+				span->next = *bucket;
+				span->size = alignedSize;
+				*bucket = span;
+				sysHeader->retainedMemory += alignedSize;
+				return;
+			}
+		}
+
+		decommit_region(addr, alignedSize);
+		virtual_free(addr, alignedSize);
 	}
 
 	void* sys_realloc(
@@ -951,11 +3676,9 @@ namespace {
 			assert(newSize >= size);
 			if (commit_region(nAddr, dSize) == 0) {
 #ifndef NDEBUG
-				atomic_lock(&header->_lock);
-				header->usedMemory += dSize;
-				header->commitSize += dSize;
-				header->requestedMemory += newSize - size;
-				atomic_unlock(&header->_lock);
+				atomic_fetch_add<MemoryOrder::RELAXED>(&header->usedMemory, static_cast<usize>(dSize));
+				atomic_fetch_add<MemoryOrder::RELAXED>(&header->commitSize, static_cast<usize>(dSize));
+				atomic_fetch_add<MemoryOrder::RELAXED>(&header->requestedMemory, newSize - size);
 #endif
 
 #if HAS_ASAN
@@ -977,6 +3700,53 @@ namespace {
 	void sys_clear(MemoryArena*) {
 	}
 
+	void sys_alloc_set_retain_limit(MemoryArena *arena, usize maxRetainedMemory) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto sysHeader = _memory_sys_header(arena);
+		{
+			atomic_lock(&header->_lock);
+			SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+			sysHeader->maxRetainedMemory = maxRetainedMemory;
+			if (sysHeader->retainedMemory <= maxRetainedMemory)
+				return;
+		}
+
+		sys_alloc_purge(arena);
+	}
+
+	void sys_alloc_purge(MemoryArena *arena) {
+		auto header = bit_cast<MemoryArenaHeader*>(arena);
+		auto sysHeader = _memory_sys_header(arena);
+
+		SysSpan *spans = nullptr;
+		{
+			atomic_lock(&header->_lock);
+			SCOPE_EXIT(atomic_unlock(&header->_lock));
+
+			for (auto& bucket : sysHeader->spanBuckets) {
+				auto span = static_cast<SysSpan*>(bucket);
+				while (span) {
+					auto next = static_cast<SysSpan*>(span->next);
+					span->next = spans;
+					spans = span;
+					span = next;
+				}
+				bucket = nullptr;
+			}
+			sysHeader->retainedMemory = 0;
+		}
+
+		// Unmap outside of the lock so allocations on other threads aren't stalled behind the syscalls
+		while (spans) {
+			auto next = static_cast<SysSpan*>(spans->next);
+			auto size = spans->size;
+			decommit_region(spans, size);
+			virtual_free(spans, size);
+			spans = next;
+		}
+	}
+
 	Allocator make_arena_allocator(usize size) {
 		Allocator allocator;
 		if (memory_arena_init(&allocator.arena, size) != 0)
@@ -1001,6 +3771,54 @@ namespace {
 		return allocator;
 	}
 
+	Allocator make_stack_allocator(void *addr, usize size, Allocator *fallback) {
+		Allocator allocator;
+		if (memory_stack_init(&allocator.arena, addr, size, fallback) != 0)
+			return {};
+		allocator.allocFn = memory_stack_alloc;
+		allocator.freeFn = memory_stack_free;
+		allocator.reallocFn = memory_stack_realloc;
+		allocator.clearFn = memory_stack_clear;
+
+		return allocator;
+	}
+
+	Allocator make_ring_allocator(usize size, bool mirrored) {
+		Allocator allocator;
+		if (memory_ring_init(&allocator.arena, size, mirrored) != 0)
+			return {};
+		allocator.allocFn = memory_ring_alloc;
+		allocator.freeFn = memory_ring_free;
+		allocator.reallocFn = memory_ring_realloc;
+		allocator.clearFn = memory_ring_clear;
+
+		return allocator;
+	}
+
+	Allocator make_buddy_allocator(usize size, usize minBlockSize) {
+		Allocator allocator;
+		if (memory_buddy_init(&allocator.arena, size, minBlockSize) != 0)
+			return {};
+		allocator.allocFn = memory_buddy_alloc;
+		allocator.freeFn = memory_buddy_free;
+		allocator.reallocFn = memory_buddy_realloc;
+		allocator.clearFn = memory_buddy_clear;
+
+		return allocator;
+	}
+
+	Allocator make_tlsf_allocator(usize size) {
+		Allocator allocator;
+		if (memory_tlsf_init(&allocator.arena, size) != 0)
+			return {};
+		allocator.allocFn = memory_tlsf_alloc;
+		allocator.freeFn = memory_tlsf_free;
+		allocator.reallocFn = memory_tlsf_realloc;
+		allocator.clearFn = memory_tlsf_clear;
+
+		return allocator;
+	}
+
 	Allocator make_pool_allocator(usize size, usize objectSize) {
 		Allocator allocator;
 		if (memory_pool_init(&allocator.arena, size, objectSize) != 0)
@@ -1013,14 +3831,31 @@ namespace {
 		return allocator;
 	}
 
-	Allocator make_heap_allocator(usize size) {
+	Allocator make_heap_allocator(usize size, usize maxSize) {
 		Allocator allocator;
-		if (memory_heap_init(&allocator.arena, size) != 0)
+		if (memory_heap_init(&allocator.arena, size, maxSize) != 0)
 			return {};
 		allocator.allocFn = memory_heap_alloc;
 		allocator.freeFn = memory_heap_free;
 		allocator.reallocFn = memory_heap_realloc;
 		allocator.clearFn = memory_heap_clear;
+		allocator.allocZeroedFn = memory_heap_alloc_zeroed;
+
+		return allocator;
+	}
+
+	Allocator make_thread_pool_allocator(usize size, usize objectSize) {
+		auto allocator = make_pool_allocator(size, objectSize);
+		if (allocator.arena)
+			_memory_arena_set_thread_owned(allocator.arena);
+
+		return allocator;
+	}
+
+	Allocator make_thread_heap_allocator(usize size, usize maxSize) {
+		auto allocator = make_heap_allocator(size, maxSize);
+		if (allocator.arena)
+			_memory_arena_set_thread_owned(allocator.arena);
 
 		return allocator;
 	}
@@ -1084,6 +3919,32 @@ namespace {
 		globalAllocator->deallocate(ptr, size);
 	}
 
+	Allocator* scratch_allocator(MemoryArena *const *conflicts, i64 conflictCount) {
+		for (auto& allocator : _threadScratchArenas.allocators) {
+			if (!allocator.arena) {
+				allocator = make_arena_allocator(scratchArenaSize);
+				if (!allocator.arena)
+					return nullptr;
+				// Only this thread ever sees its scratch arenas so they skip the arena lock
+				_memory_arena_set_thread_owned(allocator.arena);
+			}
+
+			bool conflicting = false;
+			for (i64 i = 0; i < conflictCount; ++i) {
+				if (conflicts[i] == allocator.arena) {
+					conflicting = true;
+					break;
+				}
+			}
+
+			if (!conflicting)
+				return &allocator;
+		}
+
+		assert(false && "all scratch arenas conflict");
+		return nullptr;
+	}
+
 	void* temporary_allocator_malloc(usize size) {
 		static_assert(alignof(max_align_t) >= sizeof(size));
 		auto result = temporaryAllocator->allocate(size + alignof(max_align_t), alignof(max_align_t));
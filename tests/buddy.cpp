@@ -0,0 +1,90 @@
+#include <cstdio>
+#include <cstring>
+
+#include <oak_util/memory.h>
+#include <oak_util/ptr.h>
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); return 1; } } while (0)
+
+using namespace oak;
+
+namespace {
+
+	constexpr usize MIN_BLOCK = 64 << 10;
+	constexpr usize REGION = 16 << 20;
+
+	int test_split_coalesce() {
+		MemoryArena *arena;
+		CHECK(memory_buddy_init(&arena, REGION, MIN_BLOCK) == 0);
+		SCOPE_EXIT(memory_buddy_destroy(arena));
+
+		// The first two minimum blocks are split off the same parent
+		auto a = memory_buddy_alloc(arena, MIN_BLOCK, 16);
+		auto b = memory_buddy_alloc(arena, 100, 16);
+		CHECK(a && b);
+		CHECK(ptr_diff(b, a) == static_cast<isize>(MIN_BLOCK));
+		std::memset(a, 1, MIN_BLOCK);
+		std::memset(b, 2, 100);
+
+		// The whole region is only available again once every split has been merged back
+		CHECK(memory_buddy_alloc(arena, REGION, 16) == nullptr);
+		memory_buddy_free(arena, b, 100);
+		CHECK(memory_buddy_alloc(arena, REGION, 16) == nullptr);
+		memory_buddy_free(arena, a, MIN_BLOCK);
+		auto whole = memory_buddy_alloc(arena, REGION, 16);
+		CHECK(whole == a);
+		memory_buddy_free(arena, whole, REGION);
+
+		return 0;
+	}
+
+	int test_alignment() {
+		MemoryArena *arena;
+		CHECK(memory_buddy_init(&arena, REGION, MIN_BLOCK) == 0);
+		SCOPE_EXIT(memory_buddy_destroy(arena));
+
+		auto small = memory_buddy_alloc(arena, 100, MIN_BLOCK);
+		CHECK(small && align_offset(small, MIN_BLOCK) == 0);
+		for (usize size = MIN_BLOCK; size <= REGION / 2; size *= 2) {
+			auto block = memory_buddy_alloc(arena, size, size);
+			CHECK(block);
+			CHECK(align_offset(block, size) == 0);
+			std::memset(block, 3, size);
+			memory_buddy_free(arena, block, size);
+		}
+		memory_buddy_free(arena, small, 100);
+
+		return 0;
+	}
+
+	int test_realloc() {
+		MemoryArena *arena;
+		CHECK(memory_buddy_init(&arena, REGION, MIN_BLOCK) == 0);
+		SCOPE_EXIT(memory_buddy_destroy(arena));
+
+		auto a = static_cast<u8*>(memory_buddy_alloc(arena, 1000, 16));
+		CHECK(a);
+		std::memset(a, 4, 1000);
+
+		// Staying within the block's order never moves it
+		CHECK(memory_buddy_realloc(arena, a, 1000, MIN_BLOCK, 16) == a);
+		CHECK(memory_buddy_realloc(arena, a, MIN_BLOCK, 2000, 16) == a);
+
+		auto grown = static_cast<u8*>(memory_buddy_realloc(arena, a, 2000, 4*MIN_BLOCK, 16));
+		CHECK(grown);
+		CHECK(align_offset(grown, 4*MIN_BLOCK) == 0);
+		CHECK(grown[0] == 4 && grown[999] == 4);
+		memory_buddy_free(arena, grown, 4*MIN_BLOCK);
+
+		return 0;
+	}
+
+}
+
+int main() {
+	int result = 0;
+	result |= test_split_coalesce();
+	result |= test_alignment();
+	result |= test_realloc();
+	return result;
+}
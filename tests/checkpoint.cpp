@@ -0,0 +1,86 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <oak_util/memory.h>
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); return 1; } } while (0)
+
+using namespace oak;
+
+namespace {
+
+	int test_restore() {
+		MemoryArena *arena;
+		CHECK(memory_arena_init_checkpointed(&arena, 1 << 20) == 0);
+		SCOPE_EXIT(memory_arena_destroy(arena));
+
+		auto a = static_cast<u8*>(memory_arena_alloc(arena, 4096, 64));
+		CHECK(a);
+		std::memset(a, 1, 4096);
+		auto marker = memory_arena_get_marker(arena);
+
+		CHECK(memory_arena_checkpoint(arena) == 0);
+		a[0] = 2;
+		CHECK(memory_arena_alloc(arena, 4096, 64));
+		CHECK(memory_arena_restore(arena) == 0);
+		CHECK(a[0] == 1);
+		CHECK(memory_arena_get_marker(arena).usedMemory == marker.usedMemory);
+		CHECK(memory_arena_get_marker(arena).allocationCount == marker.allocationCount);
+
+		a[1] = 3;
+		CHECK(memory_arena_drop_checkpoint(arena) == 0);
+		CHECK(a[1] == 3);
+		CHECK(memory_arena_restore(arena) == 1);
+
+		return 0;
+	}
+
+	// Allocating threads block on the arena lock while another thread moves the checkpoint around
+	int test_checkpoint_while_allocating() {
+		constexpr int THREAD_COUNT = 4;
+		constexpr int CYCLE_COUNT = 2000;
+
+		MemoryArena *arena;
+		CHECK(memory_arena_init_checkpointed(&arena, 16 << 20) == 0);
+		SCOPE_EXIT(memory_arena_destroy(arena));
+
+		std::atomic<bool> done{ false };
+		std::atomic<int> failures{ 0 };
+		std::thread threads[THREAD_COUNT];
+		for (auto& thread : threads) {
+			thread = std::thread{ [&]() {
+				while (!done.load()) {
+					// A concurrent restore may discard the allocation so it is never written to
+					if (!memory_arena_alloc(arena, 64, 8))
+						memory_arena_clear(arena);
+				}
+			} };
+		}
+
+		for (int i = 0; i < CYCLE_COUNT; ++i) {
+			if (memory_arena_checkpoint(arena) != 0
+					|| memory_arena_restore(arena) != 0
+					|| memory_arena_drop_checkpoint(arena) != 0)
+				failures.fetch_add(1);
+		}
+		done.store(true);
+
+		for (auto& thread : threads)
+			thread.join();
+
+		CHECK(failures.load() == 0);
+		CHECK(memory_arena_alloc(arena, 64, 8));
+
+		return 0;
+	}
+
+}
+
+int main() {
+	int result = 0;
+	result |= test_restore();
+	result |= test_checkpoint_while_allocating();
+	return result;
+}
@@ -0,0 +1,54 @@
+#include <cstdio>
+#include <cstring>
+
+#include <oak_util/fmt.h>
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); return 1; } } while (0)
+
+using namespace oak;
+
+namespace {
+
+	int test_from_str_short_input() {
+		i64 i;
+		CHECK(from_str(&i, String{ "-42" }, 10) == 3);
+		CHECK(i == -42);
+		u32 u;
+		CHECK(from_str(&u, String{ "ff" }, 16) == 2);
+		CHECK(u == 255);
+		f32 f;
+		CHECK(from_str(&f, String{ "0.25" }) == 4);
+		CHECK(f == 0.25f);
+		CHECK(from_str(&i, String{}, 10) == 0);
+
+		return 0;
+	}
+
+	// Inputs longer than the stack buffer used to be truncated when no global allocator was set
+	int test_from_str_long_input() {
+		CHECK(globalAllocator == nullptr);
+
+		c8 buffer[200];
+		std::memset(buffer, ' ', 150);
+		std::strcpy(buffer + 150, "987");
+
+		i64 i;
+		CHECK(from_str(&i, String{ buffer }) == 153);
+		CHECK(i == 987);
+
+		std::strcpy(buffer + 150, "2.5");
+		f64 f;
+		CHECK(from_str(&f, String{ buffer }) == 153);
+		CHECK(f == 2.5);
+
+		return 0;
+	}
+
+}
+
+int main() {
+	int result = 0;
+	result |= test_from_str_short_input();
+	result |= test_from_str_long_input();
+	return result;
+}
@@ -0,0 +1,61 @@
+#include <cstdio>
+
+#include <oak_util/memory.h>
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); return 1; } } while (0)
+
+using namespace oak;
+
+namespace {
+
+	int test_get_invalid_handle() {
+		MemoryArena *arena;
+		CHECK(memory_handle_init(&arena, 64 << 20) == 0);
+		SCOPE_EXIT(memory_handle_destroy(arena));
+
+		// Nothing is committed past the first slots of a fresh arena
+		CHECK(memory_handle_get(arena, MemoryHandleHeader::INDEX_MASK) == nullptr);
+		CHECK(memory_handle_get(arena, 1000) == nullptr);
+
+		auto handle = memory_handle_alloc(arena, 64);
+		CHECK(memory_handle_get(arena, handle));
+		memory_handle_free(arena, handle);
+		CHECK(memory_handle_get(arena, handle) == nullptr);
+
+		return 0;
+	}
+
+	int test_compact_budget_counts_dead_blocks() {
+		MemoryArena *arena;
+		CHECK(memory_handle_init(&arena, 64 << 20) == 0);
+		SCOPE_EXIT(memory_handle_destroy(arena));
+
+		constexpr int COUNT = 4096;
+		static MemoryHandle handles[COUNT];
+		for (int i = 0; i < COUNT; ++i) {
+			handles[i] = memory_handle_alloc(arena, 16);
+			CHECK(handles[i]);
+		}
+		auto live = handles[COUNT - 1];
+		*static_cast<u64*>(memory_handle_get(arena, live)) = 42;
+		for (int i = 0; i < COUNT - 1; ++i)
+			memory_handle_free(arena, handles[i]);
+
+		// Only one small block has to move, walking over the dead ones in front of it still takes several steps
+		int steps = 1;
+		while (!memory_handle_compact(arena, 4096))
+			++steps;
+		CHECK(steps > 1);
+		CHECK(*static_cast<u64*>(memory_handle_get(arena, live)) == 42);
+
+		return 0;
+	}
+
+}
+
+int main() {
+	int result = 0;
+	result |= test_get_invalid_handle();
+	result |= test_compact_budget_counts_dead_blocks();
+	return result;
+}
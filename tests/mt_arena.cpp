@@ -0,0 +1,60 @@
+#include <cstdio>
+#include <cstring>
+
+#include <oak_util/memory.h>
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); return 1; } } while (0)
+
+using namespace oak;
+
+namespace {
+
+	// A realloc from nothing is the first allocation of a new epoch, the next allocation must not clear it
+	int test_realloc_after_next_epoch() {
+		MemoryArena *arena;
+		CHECK(mt_memory_arena_init(&arena, 1 << 20) == 0);
+		SCOPE_EXIT(mt_memory_arena_destroy(arena));
+
+		CHECK(mt_memory_arena_alloc(arena, 256, 8));
+		mt_memory_arena_next_epoch(arena);
+
+		auto a = static_cast<u8*>(mt_memory_arena_realloc(arena, nullptr, 0, 64, 8));
+		CHECK(a);
+		std::memset(a, 1, 64);
+
+		auto b = static_cast<u8*>(mt_memory_arena_alloc(arena, 64, 8));
+		CHECK(b);
+		CHECK(b >= a + 64 || b + 64 <= a);
+		std::memset(b, 2, 64);
+		CHECK(a[0] == 1 && a[63] == 1);
+
+		return 0;
+	}
+
+	int test_clear_after_next_epoch() {
+		MemoryArena *arena;
+		CHECK(mt_memory_arena_init(&arena, 1 << 20) == 0);
+		SCOPE_EXIT(mt_memory_arena_destroy(arena));
+
+		CHECK(mt_memory_arena_alloc(arena, 256, 8));
+		mt_memory_arena_next_epoch(arena);
+		mt_memory_arena_clear(arena);
+
+		auto a = static_cast<u8*>(mt_memory_arena_alloc(arena, 64, 8));
+		CHECK(a);
+		std::memset(a, 1, 64);
+		auto b = static_cast<u8*>(mt_memory_arena_alloc(arena, 64, 8));
+		CHECK(b);
+		CHECK(b >= a + 64 || b + 64 <= a);
+
+		return 0;
+	}
+
+}
+
+int main() {
+	int result = 0;
+	result |= test_realloc_after_next_epoch();
+	result |= test_clear_after_next_epoch();
+	return result;
+}
@@ -0,0 +1,126 @@
+#include <cstdio>
+#include <cstring>
+
+#include <oak_util/memory.h>
+#include <oak_util/ptr.h>
+
+#define CHECK(cond) do { if (!(cond)) { std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); return 1; } } while (0)
+
+using namespace oak;
+
+namespace {
+
+	usize used_memory(MemoryArena *arena) {
+		return bit_cast<MemoryArenaHeader*>(arena)->usedMemory;
+	}
+
+	int test_alloc_free() {
+		MemoryArena *arena;
+		CHECK(memory_tlsf_init(&arena, 1 << 20) == 0);
+		SCOPE_EXIT(memory_tlsf_destroy(arena));
+
+		auto baseUsed = used_memory(arena);
+		auto a = static_cast<u8*>(memory_tlsf_alloc(arena, 100, 16));
+		auto b = static_cast<u8*>(memory_tlsf_alloc(arena, 100, 16));
+		CHECK(a && b);
+		CHECK(b >= a + 100 || b + 100 <= a);
+		std::memset(a, 1, 100);
+		std::memset(b, 2, 100);
+		CHECK(a[99] == 1 && b[0] == 2);
+
+		memory_tlsf_free(arena, a, 100);
+		memory_tlsf_free(arena, b, 100);
+		CHECK(used_memory(arena) == baseUsed);
+
+		// Larger than the arena
+		CHECK(memory_tlsf_alloc(arena, 2 << 20, 16) == nullptr);
+
+		return 0;
+	}
+
+	// Freeing every block in an interleaved order has to merge them back into the single initial block
+	int test_coalesce() {
+		constexpr int COUNT = 64;
+
+		MemoryArena *arena;
+		CHECK(memory_tlsf_init(&arena, 1 << 20) == 0);
+		SCOPE_EXIT(memory_tlsf_destroy(arena));
+
+		void *blocks[COUNT];
+		for (auto& block : blocks) {
+			block = memory_tlsf_alloc(arena, 1000, 16);
+			CHECK(block);
+		}
+		for (int i = 0; i < COUNT; i += 2)
+			memory_tlsf_free(arena, blocks[i], 1000);
+		for (int i = COUNT - 1; i > 0; i -= 2)
+			memory_tlsf_free(arena, blocks[i], 1000);
+
+		auto big = memory_tlsf_alloc(arena, 900 << 10, 16);
+		CHECK(big == blocks[0]);
+		memory_tlsf_free(arena, big, 900 << 10);
+
+		return 0;
+	}
+
+	int test_aligned_alloc() {
+		MemoryArena *arena;
+		CHECK(memory_tlsf_init(&arena, 1 << 20) == 0);
+		SCOPE_EXIT(memory_tlsf_destroy(arena));
+
+		auto baseUsed = used_memory(arena);
+		for (usize alignment = 32; alignment <= 4096; alignment *= 2) {
+			auto a = memory_tlsf_alloc(arena, 24, 16);
+			auto b = memory_tlsf_alloc(arena, 100, alignment);
+			CHECK(a && b);
+			CHECK(align_offset(b, alignment) == 0);
+			std::memset(b, 3, 100);
+			memory_tlsf_free(arena, b, 100);
+			memory_tlsf_free(arena, a, 24);
+		}
+		CHECK(used_memory(arena) == baseUsed);
+
+		return 0;
+	}
+
+	int test_realloc_in_place() {
+		MemoryArena *arena;
+		CHECK(memory_tlsf_init(&arena, 1 << 20) == 0);
+		SCOPE_EXIT(memory_tlsf_destroy(arena));
+
+		auto a = static_cast<u8*>(memory_tlsf_alloc(arena, 256, 16));
+		auto b = memory_tlsf_alloc(arena, 256, 16);
+		auto c = memory_tlsf_alloc(arena, 256, 16);
+		CHECK(a && b && c);
+		std::memset(a, 4, 256);
+
+		// Grows into the freed neighbour
+		memory_tlsf_free(arena, b, 256);
+		CHECK(memory_tlsf_realloc(arena, a, 256, 400, 16) == a);
+		CHECK(a[255] == 4);
+
+		// Shrinking never moves
+		CHECK(memory_tlsf_realloc(arena, a, 400, 64, 16) == a);
+		CHECK(a[63] == 4);
+
+		// No room left next to the block so it moves and keeps its contents
+		auto moved = static_cast<u8*>(memory_tlsf_realloc(arena, a, 64, 4096, 16));
+		CHECK(moved && moved != a);
+		CHECK(moved[0] == 4 && moved[63] == 4);
+
+		memory_tlsf_free(arena, moved, 4096);
+		memory_tlsf_free(arena, c, 256);
+
+		return 0;
+	}
+
+}
+
+int main() {
+	int result = 0;
+	result |= test_alloc_free();
+	result |= test_coalesce();
+	result |= test_aligned_alloc();
+	result |= test_realloc_in_place();
+	return result;
+}